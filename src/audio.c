@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include "audio.h"
+
+#define AUDIO_VOLUME 3000
+#define AUDIO_TONE_HZ 440.0
+#define AUDIO_CHUNK 256
+
+// Runs on SDL's audio thread whenever the device stream wants more data
+static void SDLCALL audio_callback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount)
+{
+	(void)total_amount;
+	audio_t* audio = userdata;
+	Sint16 chunk[AUDIO_CHUNK];
+	int wanted = additional_amount / (int)sizeof(Sint16);
+
+	while (wanted > 0)
+	{
+		Uint32 tail = SDL_GetAtomicU32(&audio->tail);
+		Uint32 available = SDL_GetAtomicU32(&audio->head) - tail;
+		int n = wanted < AUDIO_CHUNK ? wanted : AUDIO_CHUNK;
+
+		if (available == 0) // underrun: the emulation is behind, fill with silence
+		{
+			SDL_memset(chunk, 0, n * sizeof(Sint16));
+		}
+		else
+		{
+			if ((Uint32)n > available)
+				n = (int)available;
+			for (int i = 0; i < n; i++)
+				chunk[i] = audio->ring[(tail + i) & (AUDIO_RING_SIZE - 1)];
+			SDL_SetAtomicU32(&audio->tail, tail + n);
+		}
+
+		SDL_PutAudioStreamData(stream, chunk, n * (int)sizeof(Sint16));
+		wanted -= n;
+	}
+
+	SDL_SignalSemaphore(audio->consumed);
+}
+
+int audio_init(audio_t* audio)
+{
+	SDL_AudioSpec spec = { SDL_AUDIO_S16, 1, AUDIO_RATE };
+
+	SDL_SetAtomicU32(&audio->head, 0);
+	SDL_SetAtomicU32(&audio->tail, 0);
+	audio->phase = 0.0;
+	audio->stream = NULL;
+
+	audio->consumed = SDL_CreateSemaphore(0);
+	if (!audio->consumed)
+	{
+		printf("SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	audio->stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, audio_callback, audio);
+	if (!audio->stream)
+	{
+		printf("SDL_OpenAudioDeviceStream Error: %s\n", SDL_GetError());
+		SDL_DestroySemaphore(audio->consumed);
+		audio->consumed = NULL;
+		return -1;
+	}
+
+	SDL_ResumeAudioStreamDevice(audio->stream);
+	return 1;
+}
+
+// Renders one 60 Hz frame of beeper output. Plain CHIP-8 and SUPER-CHIP
+// play a fixed square wave; XO-CHIP plays its 128-bit pattern buffer at the
+// rate set by FX3A.
+void audio_push_frame(audio_t* audio, const chip8_t* cpu)
+{
+	if (!audio->stream)
+		return;
+
+	Uint32 head = SDL_GetAtomicU32(&audio->head);
+	Uint32 space = AUDIO_RING_SIZE - (head - SDL_GetAtomicU32(&audio->tail));
+	int n = space < AUDIO_SAMPLES_PER_FRAME ? (int)space : AUDIO_SAMPLES_PER_FRAME;
+
+	int xo = cpu->platform == CHIP8_PLATFORM_XOCHIP;
+	double step = xo
+		? 4000.0 * SDL_pow(2.0, (cpu->pitch - 64) / 48.0) / AUDIO_RATE // pattern bits per sample
+		: AUDIO_TONE_HZ / AUDIO_RATE; // square wave periods per sample
+	double period = xo ? 128.0 : 1.0;
+
+	for (int i = 0; i < n; i++)
+	{
+		Sint16 sample = 0;
+		if (cpu->sound_timer)
+		{
+			int high;
+			if (xo)
+			{
+				int bit = (int)audio->phase;
+				high = (cpu->pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+			}
+			else
+			{
+				high = audio->phase < 0.5;
+			}
+
+			sample = high ? AUDIO_VOLUME : -AUDIO_VOLUME;
+			audio->phase += step;
+			if (audio->phase >= period)
+				audio->phase -= period * (int)(audio->phase / period);
+		}
+		audio->ring[(head + i) & (AUDIO_RING_SIZE - 1)] = sample;
+	}
+
+	SDL_SetAtomicU32(&audio->head, head + n);
+}
+
+// Samples rendered but not yet handed to the device
+Uint32 audio_queued(audio_t* audio)
+{
+	return SDL_GetAtomicU32(&audio->head) - SDL_GetAtomicU32(&audio->tail);
+}
+
+// Sleeps until the audio thread has drained some samples, so a frame loop
+// can be clocked by the audio device instead of a timer
+void audio_wait(audio_t* audio, Sint32 timeout_ms)
+{
+	SDL_WaitSemaphoreTimeout(audio->consumed, timeout_ms);
+}
+
+void audio_quit(audio_t* audio)
+{
+	if (audio->stream)
+		SDL_DestroyAudioStream(audio->stream); // stops the callback before the semaphore goes away
+	if (audio->consumed)
+		SDL_DestroySemaphore(audio->consumed);
+	audio->stream = NULL;
+	audio->consumed = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef _AUDIO_H
+#define _AUDIO_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+
+#define AUDIO_RATE 48000
+#define AUDIO_SAMPLES_PER_FRAME (AUDIO_RATE / 60)
+#define AUDIO_RING_SIZE 8192 // samples, must be a power of two
+
+// The beeper. The emulation thread renders each frame's worth of samples
+// into a single-producer/single-consumer ring and SDL's audio thread drains
+// it into the device stream. Neither side ever locks or allocates; if the
+// ring is full the emulation side drops samples, if it's empty the audio
+// side plays silence.
+typedef struct {
+	SDL_AudioStream* stream;
+	Sint16 ring[AUDIO_RING_SIZE];
+	SDL_AtomicU32 head; // free-running count of samples written, owned by the emulation thread
+	SDL_AtomicU32 tail; // free-running count of samples read, owned by the audio thread
+	double phase; // waveform position, emulation thread only
+	SDL_Semaphore* consumed; // signalled by the audio thread after it drains samples
+} audio_t;
+
+int audio_init(audio_t* audio);
+void audio_push_frame(audio_t* audio, const chip8_t* cpu);
+Uint32 audio_queued(audio_t* audio);
+void audio_wait(audio_t* audio, Sint32 timeout_ms);
+void audio_quit(audio_t* audio);
+#endif
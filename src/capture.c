@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+
+#define CAPTURE_WIDTH CHIP8_HIRES_WIDTH
+#define CAPTURE_HEIGHT CHIP8_HIRES_HEIGHT
+
+// Luma for each (plane 1 bit << 1) | plane 0 bit, matching the window palette
+static const uint8_t luma[4] = { 0x00, 0xFF, 0xAA, 0x55 };
+
+static void convert_frame(const capture_frame_t* frame, uint8_t* out)
+{
+	int scale = frame->hires ? 1 : 2;
+
+	for (int y = 0; y < CAPTURE_HEIGHT; y++)
+	{
+		int sy = y / scale;
+		for (int x = 0; x < CAPTURE_WIDTH; x++)
+		{
+			int sx = x / scale;
+			int shift = 63 - (sx & 63);
+			int color = ((frame->display[0][sy][sx >> 6] >> shift) & 1) | (((frame->display[1][sy][sx >> 6] >> shift) & 1) << 1);
+			out[y * CAPTURE_WIDTH + x] = luma[color];
+		}
+	}
+}
+
+static int SDLCALL capture_thread(void* data)
+{
+	capture_t* capture = data;
+	static const char marker[] = "FRAME\n";
+	uint8_t pixels[CAPTURE_WIDTH * CAPTURE_HEIGHT];
+
+	for (;;)
+	{
+		SDL_WaitSemaphore(capture->full);
+		if (SDL_GetAtomicInt(&capture->done) && capture->tail == capture->head) // head is final once done is set
+			break;
+
+		const capture_frame_t* frame = &capture->pool[capture->tail & (CAPTURE_POOL - 1)];
+		int repeat = capture->drop_duplicates ? 1 : frame->repeat;
+		convert_frame(frame, pixels);
+		capture->tail++;
+		SDL_SignalSemaphore(capture->free);
+
+		for (int i = 0; i < repeat; i++)
+		{
+			if (capture->format == CAPTURE_Y4M)
+				sink_write(capture->out, marker, sizeof(marker) - 1);
+			sink_write(capture->out, pixels, sizeof(pixels));
+		}
+		capture->written += repeat;
+	}
+
+	return 0;
+}
+
+// Opens a capture stream on filename, or on stdout for "-"
+int capture_open(capture_t* capture, sink_t* sink, const char* filename, capture_format_t format, int drop_duplicates)
+{
+	capture->format = format;
+	capture->drop_duplicates = drop_duplicates;
+	capture->head = 0;
+	capture->tail = 0;
+	capture->staged = 0;
+	capture->written = 0;
+	SDL_SetAtomicInt(&capture->done, 0);
+
+	capture->out = sink_open(sink, filename);
+	if (!capture->out)
+		return -1;
+
+	capture->free = SDL_CreateSemaphore(CAPTURE_POOL - 1); // one slot is always the staged frame
+	capture->full = SDL_CreateSemaphore(0);
+	if (!capture->free || !capture->full)
+	{
+		printf("SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+		goto fail;
+	}
+
+	if (format == CAPTURE_Y4M)
+	{
+		char header[64];
+		int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", CAPTURE_WIDTH, CAPTURE_HEIGHT);
+		sink_write(capture->out, header, len);
+	}
+
+	capture->thread = SDL_CreateThread(capture_thread, "chip8 capture", capture);
+	if (!capture->thread)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		goto fail;
+	}
+	return 1;
+
+fail:
+	if (capture->free)
+		SDL_DestroySemaphore(capture->free);
+	if (capture->full)
+		SDL_DestroySemaphore(capture->full);
+	sink_close(capture->out);
+	return -1;
+}
+
+// Records the current display as the next 60 Hz frame. Consumes the CPU's
+// dirty rows; with none set, or when the redrawn picture matches, the staged
+// frame just repeats.
+void capture_push(capture_t* capture, chip8_t* cpu)
+{
+	capture_frame_t* frame = &capture->pool[capture->head & (CAPTURE_POOL - 1)];
+	uint64_t dirty = chip8_get_dirty(cpu);
+	chip8_clear_dirty(cpu);
+
+	if (capture->staged)
+	{
+		if (!dirty || (frame->hires == cpu->hires && memcmp(frame->display, cpu->display, sizeof(frame->display)) == 0))
+		{
+			frame->repeat++;
+			return;
+		}
+
+		capture->head++;
+		SDL_SignalSemaphore(capture->full);
+		SDL_WaitSemaphore(capture->free); // only blocks once the whole pool is queued
+		frame = &capture->pool[capture->head & (CAPTURE_POOL - 1)];
+	}
+
+	memcpy(frame->display, cpu->display, sizeof(frame->display));
+	frame->hires = cpu->hires;
+	frame->repeat = 1;
+	capture->staged = 1;
+}
+
+// Flushes the staged frame, waits for the writer to drain and hands the
+// stream back to the sink to close
+void capture_close(capture_t* capture)
+{
+	if (capture->staged)
+	{
+		capture->head++;
+		SDL_SignalSemaphore(capture->full);
+		capture->staged = 0;
+	}
+	SDL_SetAtomicInt(&capture->done, 1);
+	SDL_SignalSemaphore(capture->full);
+	SDL_WaitThread(capture->thread, NULL);
+
+	SDL_DestroySemaphore(capture->free);
+	SDL_DestroySemaphore(capture->full);
+	sink_close(capture->out);
+}
@@ -0,0 +1,43 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "sink.h"
+
+#define CAPTURE_POOL 64 // frames buffered between the emulation and the writer, must be a power of two
+
+typedef enum {
+	CAPTURE_Y4M, // YUV4MPEG2 monochrome, readable by ffmpeg and most encoders
+	CAPTURE_GRAY8, // headerless 8-bit luma frames
+} capture_format_t;
+
+typedef struct {
+	uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	int hires;
+	int repeat; // number of consecutive emulated frames showing this picture
+} capture_frame_t;
+
+// Headless video capture. Every stream is 128x64 at 60 fps; lo-res frames
+// are doubled. The emulation side only copies the display into a pool slot;
+// a background thread converts them and hands them to the sink, so disk stalls never reach
+// the interpreter until the whole pool is queued. A frame identical to the
+// previous one is folded into its repeat count instead of taking a slot.
+typedef struct {
+	sink_stream_t* out;
+	capture_format_t format;
+	int drop_duplicates; // write repeated frames once instead of repeat times
+	capture_frame_t pool[CAPTURE_POOL];
+	Uint32 head; // frames handed to the writer, emulation side only
+	Uint32 tail; // frames written, writer only
+	int staged; // bool: pool[head] holds a frame that may still repeat
+	SDL_Semaphore* free; // slots the emulation side may fill
+	SDL_Semaphore* full; // slots the writer may drain
+	SDL_AtomicInt done;
+	SDL_Thread* thread;
+	Uint64 written; // frames written out, including repeats
+} capture_t;
+
+int capture_open(capture_t* capture, sink_t* sink, const char* filename, capture_format_t format, int drop_duplicates);
+void capture_push(capture_t* capture, chip8_t* cpu);
+void capture_close(capture_t* capture);
+#endif
@@ -2,6 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "cpu.h"
+#include "rom.h"
+
+// SSE2 is part of every x86-64 target, so it's picked at compile time
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHIP8_SSE2 1
+#endif
 
 uint8_t font[80] = {
 0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -22,221 +29,1331 @@ uint8_t font[80] = {
 0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-void init_cpu(chip8_t* cpu)
+// SUPER-CHIP 8x10 digits used by FX30
+uint8_t big_font[160] = {
+0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+// One decode cache entry. Single instructions have their operands unpacked
+// up front; fused entries run two or three instructions in one dispatch.
+// Operand fields are reused by each op as noted in decode().
+struct chip8_uop {
+	uint8_t op; // UOP_*, UOP_NONE until decoded
+	uint8_t count; // instructions covered
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t kk;
+	uint16_t nnn;
+};
+
+// Furthest a cached entry reads past its own address: a fused group of three
+// instructions. Writes invalidate every entry that could have read them.
+#define UOP_SPAN 6
+
+// The decode cache is kept per page, and every page starts out pointing here
+// so the run loop needs no check before the lookup. Only decode() allocates a
+// page's real entries, so this one is never written and instances on
+// different threads can all read it.
+static chip8_uop_t no_uops[CHIP8_PAGE_SIZE];
+
+// FX33 digits for every byte value
+#define BCD(n) { (n) / 100, (n) / 10 % 10, (n) % 10 }
+#define BCD4(n) BCD(n), BCD(n + 1), BCD(n + 2), BCD(n + 3)
+#define BCD16(n) BCD4(n), BCD4(n + 4), BCD4(n + 8), BCD4(n + 12)
+static const uint8_t bcd[256][3] = {
+	BCD16(0),   BCD16(16),  BCD16(32),  BCD16(48),  BCD16(64),  BCD16(80),  BCD16(96),  BCD16(112),
+	BCD16(128), BCD16(144), BCD16(160), BCD16(176), BCD16(192), BCD16(208), BCD16(224), BCD16(240),
+};
+#undef BCD16
+#undef BCD4
+#undef BCD
+
+int init_cpu(chip8_t* cpu)
+{
+	return chip8_init(cpu, CHIP8_PLATFORM_CHIP8);
+}
+
+int chip8_init(chip8_t* cpu, chip8_platform_t platform)
 {
-	memset(cpu->memory, 0, 4096);
+	// Only XO-CHIP pays for the 64 KB address space
+	size_t mem_size = platform == CHIP8_PLATFORM_XOCHIP ? CHIP8_XO_MEM_SIZE : CHIP8_MEM_SIZE;
+	size_t pages = mem_size / CHIP8_PAGE_SIZE;
+
+	cpu->memory = calloc(mem_size, 1);
+	cpu->page = malloc(pages * sizeof(*cpu->page));
+	if (!cpu->memory || !cpu->page)
+	{
+		printf("Could not allocate CHIP-8 memory\n");
+		free(cpu->memory);
+		free(cpu->page);
+		return -1;
+	}
+
+	cpu->mem_mask = (uint16_t)(mem_size - 1);
+	for (size_t i = 0; i < pages; i++)
+		cpu->page[i] = &cpu->memory[i * CHIP8_PAGE_SIZE];
+	memset(cpu->shared, 0, sizeof(cpu->shared));
+	memset(cpu->trap, 0, sizeof(cpu->trap));
+	memset(cpu->decoded, 0, sizeof(cpu->decoded));
+	cpu->uops = NULL;
+	cpu->idle_pc = -1;
+	cpu->cycles_per_frame = CHIP8_DEFAULT_CYCLES_PER_FRAME;
+	cpu->watch = NULL;
+	cpu->watch_hit = 0;
+
 	memset(cpu->V, 0, 16);
 	memset(cpu->stack, 0, sizeof(cpu->stack));
 	memset(cpu->keypad, 0, 16);
+	memset(cpu->rpl, 0, sizeof(cpu->rpl));
+	memset(cpu->pattern, 0, sizeof(cpu->pattern));
+	memset(cpu->display, 0, sizeof(cpu->display));
+	cpu->dirty = CHIP8_ALL_ROWS;
 
 	cpu->ir = 0;
 	cpu->pc = 0x200;
 	cpu->sp = 0;
 	cpu->delay_timer = 0;
 	cpu->sound_timer = 0;
-	cpu->opcode = 0;
+	cpu->draw_flag = 0;
+	cpu->hires = 0;
+	cpu->halted = 0;
+	cpu->waiting = 0;
+	cpu->wait_reg = 0;
+	chip8_set_seed(cpu, 0);
+	cpu->planes = 1;
+	cpu->pitch = 64; // 4000 Hz playback rate
+	cpu->platform = platform;
+	chip8_set_quirks(cpu, chip8_default_quirks(platform));
 
-	memcpy(&cpu->memory[0], font, sizeof(font));
+	memcpy(&cpu->memory[CHIP8_FONT_ADDR], font, sizeof(font));
+	memcpy(&cpu->memory[CHIP8_BIG_FONT_ADDR], big_font, sizeof(big_font));
+	return 1;
 }
 
-int load_rom(chip8_t* cpu, const char* filename)
+void free_cpu(chip8_t* cpu)
+{
+	size_t mem_size = chip8_get_mem_size(cpu);
+
+	// Pages that are neither shared nor part of the backing store were
+	// materialized one at a time by chip8_unshare_page()
+	for (size_t i = 0; i < mem_size / CHIP8_PAGE_SIZE; i++)
+	{
+		if (chip8_page_shared(cpu, i))
+			continue;
+		if (cpu->memory && cpu->page[i] >= cpu->memory && cpu->page[i] < cpu->memory + mem_size)
+			continue;
+		free(cpu->page[i]);
+	}
+
+	if (cpu->uops)
+	{
+		for (size_t i = 0; i < mem_size / CHIP8_PAGE_SIZE; i++)
+		{
+			if (cpu->uops[i] != no_uops)
+				free(cpu->uops[i]);
+		}
+	}
+
+	free(cpu->page);
+	free(cpu->memory);
+	free(cpu->uops);
+	cpu->page = NULL;
+	cpu->memory = NULL;
+	cpu->uops = NULL;
+	memset(cpu->shared, 0, sizeof(cpu->shared));
+	memset(cpu->trap, 0, sizeof(cpu->trap));
+	memset(cpu->decoded, 0, sizeof(cpu->decoded));
+}
+
+// Makes dst a copy of tmpl that shares all of tmpl's memory pages; a page is
+// only copied the first time dst writes to it. tmpl is treated as an
+// immutable boot image: it must not be run or freed while clones of it exist.
+int chip8_clone(chip8_t* dst, const chip8_t* tmpl)
 {
-	FILE* fp = fopen(filename, "rb");
-	if (!fp)
+	size_t pages = chip8_get_mem_size(tmpl) / CHIP8_PAGE_SIZE;
+
+	*dst = *tmpl;
+	dst->memory = NULL;
+	dst->page = malloc(pages * sizeof(*dst->page));
+	if (!dst->page)
 	{
-		printf("File not found: %s", filename);
+		printf("Could not allocate page table\n");
 		return -1;
 	}
 
-	fseek(fp, 0, SEEK_END);
-	unsigned long buf_size = ftell(fp);
-	rewind(fp);
+	memcpy(dst->page, tmpl->page, pages * sizeof(*dst->page));
+	memset(dst->shared, 0, sizeof(dst->shared));
+	for (size_t i = 0; i < pages; i++)
+		dst->shared[i >> 6] |= 1ull << (i & 63);
+	memcpy(dst->trap, dst->shared, sizeof(dst->trap));
+	memset(dst->decoded, 0, sizeof(dst->decoded));
+	dst->uops = NULL; // each clone decodes into its own cache, a page at a time
+	dst->watch = NULL;
+	dst->watch_hit = 0;
+	return 1;
+}
+
+// A page stays trapped while any write to it needs the slow path
+static void update_trap(chip8_t* cpu, unsigned int page)
+{
+	int trapped = chip8_page_shared(cpu, page) || chip8_page_decoded(cpu, page);
+
+	if (cpu->watch)
+	{
+		const uint8_t* flags = &cpu->watch[page << CHIP8_PAGE_SHIFT];
+		for (int i = 0; i < CHIP8_PAGE_SIZE && !trapped; i++)
+			trapped = flags[i] & CHIP8_DEBUG_WATCH;
+	}
+
+	if (trapped)
+		cpu->trap[page >> 6] |= 1ull << (page & 63);
+	else
+		cpu->trap[page >> 6] &= ~(1ull << (page & 63));
+}
+
+// Points the write barrier at a debugger's per-address flags (one byte per
+// address of the full 64 KB space), or detaches it with NULL. Call again
+// whenever the watched addresses change.
+void chip8_set_watch(chip8_t* cpu, const uint8_t* flags)
+{
+	cpu->watch = flags;
+	cpu->watch_hit = 0;
+	for (unsigned int page = 0; page < chip8_get_mem_size(cpu) / CHIP8_PAGE_SIZE; page++)
+		update_trap(cpu, page);
+}
+
+// Drops decoded instructions that read any of [addr, addr + len). A page
+// stays marked decoded afterwards, so later writes keep invalidating.
+static void invalidate(chip8_t* cpu, uint16_t addr, size_t len)
+{
+	if (!cpu->uops)
+		return;
+	for (size_t i = 0; i < len + UOP_SPAN - 1; i++)
+	{
+		uint16_t at = (addr - (UOP_SPAN - 1) + i) & cpu->mem_mask;
+		chip8_uop_t* uops = cpu->uops[at >> CHIP8_PAGE_SHIFT];
+		if (uops != no_uops)
+			uops[at & (CHIP8_PAGE_SIZE - 1)].op = 0;
+	}
+}
+
+void chip8_unshare_page(chip8_t* cpu, unsigned int page)
+{
+	uint8_t* copy = malloc(CHIP8_PAGE_SIZE);
+	if (!copy)
+	{
+		printf("Could not allocate page %u\n", page);
+		abort();
+	}
+
+	memcpy(copy, cpu->page[page], CHIP8_PAGE_SIZE);
+	cpu->page[page] = copy;
+	cpu->shared[page >> 6] &= ~(1ull << (page & 63));
+	update_trap(cpu, page);
+}
+
+// Write barrier slow path for trapped pages: copies a template page before
+// its first write, drops decoded instructions that read the address and
+// reports writes to watched addresses
+void chip8_write_slow(chip8_t* cpu, uint16_t addr, uint8_t value)
+{
+	unsigned int page = addr >> CHIP8_PAGE_SHIFT;
+
+	if (chip8_page_shared(cpu, page))
+		chip8_unshare_page(cpu, page);
+	if (chip8_page_decoded(cpu, page))
+		invalidate(cpu, addr, 1);
+	if (cpu->watch && (cpu->watch[addr] & CHIP8_DEBUG_WATCH))
+	{
+		cpu->watch_hit = 1;
+		cpu->watch_addr = addr;
+	}
+	cpu->page[page][addr & (CHIP8_PAGE_SIZE - 1)] = value;
+}
+
+void chip8_write_block(chip8_t* cpu, uint16_t addr, const uint8_t* data, size_t len)
+{
+	while (len)
+	{
+		addr &= cpu->mem_mask;
+		unsigned int page = addr >> CHIP8_PAGE_SHIFT;
+		unsigned int offset = addr & (CHIP8_PAGE_SIZE - 1);
+		size_t chunk = CHIP8_PAGE_SIZE - offset;
+		if (chunk > len)
+			chunk = len;
+
+		if (chip8_page_shared(cpu, page))
+			chip8_unshare_page(cpu, page);
+		if (chip8_page_decoded(cpu, page))
+			invalidate(cpu, addr, chunk);
+		if (cpu->watch && chip8_page_trapped(cpu, page))
+		{
+			for (size_t i = 0; i < chunk; i++)
+			{
+				if (cpu->watch[addr + i] & CHIP8_DEBUG_WATCH)
+				{
+					cpu->watch_hit = 1;
+					cpu->watch_addr = (uint16_t)(addr + i);
+					break;
+				}
+			}
+		}
+		memcpy(&cpu->page[page][offset], data, chunk);
+
+		addr += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+void chip8_read_block(const chip8_t* cpu, uint16_t addr, uint8_t* out, size_t len)
+{
+	while (len)
+	{
+		addr &= cpu->mem_mask;
+		unsigned int offset = addr & (CHIP8_PAGE_SIZE - 1);
+		size_t chunk = CHIP8_PAGE_SIZE - offset;
+		if (chunk > len)
+			chunk = len;
+
+		memcpy(out, &cpu->page[addr >> CHIP8_PAGE_SHIFT][offset], chunk);
 
-	printf("Read %lu bytes from %s\n", buf_size, filename);
-	fread(&cpu->memory[0x200], buf_size, 1, fp); // Read the rom into chip8_t memory
+		addr += chunk;
+		out += chunk;
+		len -= chunk;
+	}
+}
 
-	fclose(fp);
+int load_rom(chip8_t* cpu, const char* filename)
+{
+	chip8_rom_t rom;
+	if (chip8_rom_map(&rom, filename) < 0)
+		return -1;
+
+	printf("Read %lu bytes from %s\n", (unsigned long)rom.size, filename);
+	int ret = chip8_load_rom_mem(cpu, rom.data, rom.size);
+
+	chip8_rom_unmap(&rom);
+	return ret;
+}
+
+// Copies a ROM image that's already in memory (e.g. a shared chip8_rom_t
+// mapping) into the program area at 0x200.
+int chip8_load_rom_mem(chip8_t* cpu, const uint8_t* data, size_t len)
+{
+	size_t max_size = chip8_get_mem_size(cpu) - CHIP8_PROG_START;
+	if (len > max_size)
+	{
+		printf("ROM too large: %lu bytes (max %lu)\n", (unsigned long)len, (unsigned long)max_size);
+		return -1;
+	}
+
+	chip8_write_block(cpu, CHIP8_PROG_START, data, len);
 	return 1;
 }
 
-void emulate_cycle(chip8_t* cpu)
+// XORs a sprite, already shifted into place as one 128-bit mask per row,
+// into rows y.. of a plane, wrapping at height. Returns 1 if any pixel was
+// already set (a collision). A display row is exactly one SSE register, so
+// each row is a load, an AND, an XOR and a store.
+static inline int blit(uint64_t (*plane)[2], const uint64_t (*mask)[2], int y, int rows, int height)
 {
-	// Get next two byte opcode
-	cpu->opcode = (cpu->memory[cpu->pc] << 8) | (cpu->memory[cpu->pc + 1]);
+#ifdef CHIP8_SSE2
+	__m128i hit = _mm_setzero_si128();
+	for (int row = 0; row < rows; row++)
+	{
+		int py = y + row < height ? y + row : y + row - height;
+		__m128i* line = (__m128i*)plane[py];
+		__m128i m = _mm_loadu_si128((const __m128i*)mask[row]);
+		__m128i d = _mm_load_si128(line);
+		hit = _mm_or_si128(hit, _mm_and_si128(d, m));
+		_mm_store_si128(line, _mm_xor_si128(d, m));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) != 0xFFFF;
+#else
+	uint64_t hit = 0;
+	for (int row = 0; row < rows; row++)
+	{
+		int py = y + row < height ? y + row : y + row - height;
+		hit |= (plane[py][0] & mask[row][0]) | (plane[py][1] & mask[row][1]);
+		plane[py][0] ^= mask[row][0];
+		plane[py][1] ^= mask[row][1];
+	}
+	return hit != 0;
+#endif
+}
+
+// Scrolls and CLS only touch the bitplanes selected with FN01
+
+// 00CN: rows move down by n, the top n rows are cleared
+static void scroll_down(chip8_t* cpu, int n)
+{
+	cpu->dirty = CHIP8_ALL_ROWS;
+	int height = chip8_get_height(cpu);
+	if (n > height)
+		n = height;
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (!(cpu->planes & (1 << p)))
+			continue;
+		memmove(&cpu->display[p][n], &cpu->display[p][0], (height - n) * sizeof(cpu->display[p][0]));
+		memset(&cpu->display[p][0], 0, n * sizeof(cpu->display[p][0]));
+	}
+}
+
+// 00DN: XO-CHIP, rows move up by n, the bottom n rows are cleared
+static void scroll_up(chip8_t* cpu, int n)
+{
+	cpu->dirty = CHIP8_ALL_ROWS;
+	int height = chip8_get_height(cpu);
+	if (n > height)
+		n = height;
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (!(cpu->planes & (1 << p)))
+			continue;
+		memmove(&cpu->display[p][0], &cpu->display[p][n], (height - n) * sizeof(cpu->display[p][0]));
+		memset(&cpu->display[p][height - n], 0, n * sizeof(cpu->display[p][0]));
+	}
+}
+
+// 00FB/00FC: horizontal scrolls by 4 pixels are a shift across each row's words
+static void scroll_right(chip8_t* cpu)
+{
+	cpu->dirty = CHIP8_ALL_ROWS;
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (!(cpu->planes & (1 << p)))
+			continue;
+		for (int y = 0; y < chip8_get_height(cpu); y++)
+		{
+			uint64_t* row = cpu->display[p][y];
+			if (cpu->hires)
+				row[1] = (row[1] >> 4) | (row[0] << 60);
+			row[0] >>= 4;
+		}
+	}
+}
+
+static void scroll_left(chip8_t* cpu)
+{
+	cpu->dirty = CHIP8_ALL_ROWS;
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (!(cpu->planes & (1 << p)))
+			continue;
+		for (int y = 0; y < chip8_get_height(cpu); y++)
+		{
+			uint64_t* row = cpu->display[p][y];
+			row[0] <<= 4;
+			if (cpu->hires)
+			{
+				row[0] |= row[1] >> 60;
+				row[1] <<= 4;
+			}
+		}
+	}
+}
+
+static void set_hires(chip8_t* cpu, int hires)
+{
+	cpu->hires = hires;
+	memset(cpu->display, 0, sizeof(cpu->display));
+	cpu->dirty = CHIP8_ALL_ROWS;
+	cpu->draw_flag = 1;
+}
+
+// Size of the instruction at addr; skips have to step over the whole 4-byte
+// XO-CHIP F000 NNNN
+static inline int instruction_size(const chip8_t* cpu, uint16_t addr)
+{
+	if (cpu->platform == CHIP8_PLATFORM_XOCHIP
+		&& chip8_read(cpu, addr) == 0xF0 && chip8_read(cpu, addr + 1) == 0x00)
+		return 4;
+	return 2;
+}
+
+// Size of the instruction after the current one
+static inline int next_size(const chip8_t* cpu)
+{
+	return instruction_size(cpu, cpu->pc + 2);
+}
+
+// The interpreter is written once with the quirk set as a parameter and
+// stamped out for every combination of quirks below. Since quirks is a
+// compile-time constant in each copy, the QUIRK() checks fold away and the
+// selected interpreter carries no runtime quirk branches.
+#define QUIRK(q) (quirks & CHIP8_QUIRK_##q)
+
+// DXYN, shared by the interpreter and the decode cache. Takes the sprite
+// position and I by value so register-cached callers needn't write them
+// back first, and returns the collision flag for VF.
+//
+// Each sprite row is shifted into place across the row's two words in one
+// go: the part that runs past a word boundary spills into the next word, or
+// wraps round to word 0 at the right edge unless the CLIP quirk drops it.
+static CHIP8_ALWAYS_INLINE uint8_t draw(chip8_t* cpu, uint8_t x_coord, uint8_t y_coord, uint16_t addr, int n, const unsigned int quirks)
+{
+	int width = chip8_get_width(cpu);
+	int height = chip8_get_height(cpu);
+	int rows = n;
+	int cols = 8;
+	uint8_t collision = 0;
+
+	if (rows == 0 && cpu->platform != CHIP8_PLATFORM_CHIP8)
+	{
+		rows = 16;
+		cols = 16;
+	}
+
+	// The sprite's origin always wraps; rows that run off the bottom either
+	// wrap too or are clipped with the CLIP quirk
+	int x0 = x_coord % width;
+	int y0 = y_coord % height;
+	int visible = QUIRK(CLIP) && y0 + rows > height ? height - y0 : rows;
+	int word = x0 >> 6;
+	int shift = x0 & 63;
+	int spill = word + 1 < width / 64 ? word + 1 : QUIRK(CLIP) ? -1 : 0;
+
+	// With several XO-CHIP planes selected, each plane's sprite data
+	// follows the previous plane's at I
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (!(cpu->planes & (1 << p)))
+			continue;
+
+		uint64_t mask[16][2];
+		for (int row = 0; row < visible; row++)
+		{
+			// 16-wide sprites are stored as two bytes per row
+			uint16_t sprite_row = cols == 16
+				? (chip8_read(cpu, addr + row * 2) << 8) | chip8_read(cpu, addr + row * 2 + 1)
+				: chip8_read(cpu, addr + row) << 8;
+			uint64_t bits = (uint64_t)sprite_row << 48;
+
+			mask[row][0] = 0;
+			mask[row][1] = 0;
+			mask[row][word] = bits >> shift;
+			if (shift && spill >= 0)
+				mask[row][spill] |= bits << (64 - shift);
+
+			if (sprite_row)
+			{
+				int py = y0 + row < height ? y0 + row : y0 + row - height;
+				cpu->dirty |= 1ull << py;
+			}
+		}
+		collision |= blit(cpu->display[p], (const uint64_t (*)[2])mask, y0, visible, height);
+		addr += rows * (cols / 8);
+	}
+	cpu->draw_flag = 1;
+	return collision;
+}
+
+static CHIP8_ALWAYS_INLINE void execute(chip8_t* cpu, const unsigned int quirks)
+{
+	if (cpu->halted || cpu->waiting)
+		return;
+
+	// Get next two byte opcode and decode its operand fields once
+	uint16_t opcode = (chip8_read(cpu, cpu->pc) << 8) | chip8_read(cpu, cpu->pc + 1);
+	uint8_t x = (opcode & 0x0F00) >> 8;
+	uint8_t y = (opcode & 0x00F0) >> 4;
+	uint8_t nn = opcode & 0x00FF;
+	uint16_t nnn = opcode & 0x0FFF;
 
-	switch (cpu->opcode & 0xF000)
+	switch (opcode & 0xF000)
 	{
 		case 0x0000: // 0NNN
-			switch(cpu->opcode)
+			switch(opcode)
 			{
 				case 0x00E0: // CLS - clear screen
 					clear_screen(cpu);
+					cpu->draw_flag = 1;
 					cpu->pc += 2;
 					break;
 				case 0x00EE:  // RET - return from a subroutine, sets PC = stack[sp] then sp--
-					cpu->sp -= 1;
+					cpu->sp = (cpu->sp - 1) & 15; // the stack wraps rather than running off either end
 					cpu->pc = cpu->stack[cpu->sp];
 					cpu->pc += 2;
 					break;
+				case 0x00FB: // SCHIP: scroll right 4 pixels
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown;
+					scroll_right(cpu);
+					cpu->draw_flag = 1;
+					cpu->pc += 2;
+					break;
+				case 0x00FC: // SCHIP: scroll left 4 pixels
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown;
+					scroll_left(cpu);
+					cpu->draw_flag = 1;
+					cpu->pc += 2;
+					break;
+				case 0x00FD: // SCHIP: exit the interpreter
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown;
+					cpu->halted = 1;
+					break;
+				case 0x00FE: // SCHIP: low-res (64x32) mode
+				case 0x00FF: // SCHIP: high-res (128x64) mode
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown;
+					set_hires(cpu, opcode == 0x00FF);
+					cpu->pc += 2;
+					break;
 				default:
-					printf("Error: unknown opcode: %x", cpu->opcode);
+					if ((opcode & 0xFFF0) == 0x00C0 && cpu->platform != CHIP8_PLATFORM_CHIP8) // SCHIP 00CN: scroll down N rows
+					{
+						scroll_down(cpu, opcode & 0x000F);
+						cpu->draw_flag = 1;
+						cpu->pc += 2;
+						break;
+					}
+					if ((opcode & 0xFFF0) == 0x00D0 && cpu->platform == CHIP8_PLATFORM_XOCHIP) // XO-CHIP 00DN: scroll up N rows
+					{
+						scroll_up(cpu, opcode & 0x000F);
+						cpu->draw_flag = 1;
+						cpu->pc += 2;
+						break;
+					}
+				unknown:
+					printf("Error: unknown opcode: %x", opcode);
 					cpu->pc += 2;
 					break;
 			}
 			break;
 		case 0x1000: // 1NNN: JP addr - jump to NNN
-			cpu->pc = cpu->opcode & 0x0FFF;
+			cpu->pc = nnn;
 			break;
 		case 0x2000: // 2NNN: calls subroutine at NNN
 			cpu->stack[cpu->sp] = cpu->pc;
-			cpu->sp++;
-			cpu->pc = cpu->opcode & 0x0FFF;
+			cpu->sp = (cpu->sp + 1) & 15;
+			cpu->pc = nnn;
 			break;
 		case 0x3000: // 3XNN: Skips next instruction if Vx == NN
-			if (cpu->V[(cpu->opcode & 0x0F00)] == (cpu->opcode & 0x00FF))
-			{
-				cpu->pc += 4;
-				break;
-			}
+			if (cpu->V[x] == nn)
+				cpu->pc += next_size(cpu);
 			cpu->pc += 2;
 			break;
 		case 0x4000: // 4XNN: Skips next instruction if Vx != NN
-			if (cpu->V[(cpu->opcode & 0x0F00)] != (cpu->opcode & 0x00FF))
-			{
-				cpu->pc += 4;
-				break;
-			}
+			if (cpu->V[x] != nn)
+				cpu->pc += next_size(cpu);
 			cpu->pc += 2;
 			break;
 		case 0x5000: // 5XY0: Skips if the values in VX and VY are equal
-			if (cpu->V[(cpu->opcode & 0x0F00)] == cpu->V[(cpu->opcode & 0x00F0)])
+			switch (opcode & 0x000F)
 			{
-				cpu->pc += 4;
-				break;
+				case 0x0000:
+					if (cpu->V[x] == cpu->V[y])
+						cpu->pc += next_size(cpu);
+					break;
+				case 0x0002: // 5XY2: XO-CHIP, save VX..VY to memory at I (I unchanged)
+					if (cpu->platform != CHIP8_PLATFORM_XOCHIP)
+						goto unknown;
+					for (int i = 0; i <= abs(x - y); i++)
+						chip8_write(cpu, cpu->ir + i, cpu->V[x < y ? x + i : x - i]);
+					break;
+				case 0x0003: // 5XY3: XO-CHIP, load VX..VY from memory at I (I unchanged)
+					if (cpu->platform != CHIP8_PLATFORM_XOCHIP)
+						goto unknown;
+					for (int i = 0; i <= abs(x - y); i++)
+						cpu->V[x < y ? x + i : x - i] = chip8_read(cpu, cpu->ir + i);
+					break;
+				default:
+					goto unknown;
 			}
 			cpu->pc += 2;
 			break;
 		case 0x6000: // 6XNN:  Vx = NN
-			(cpu->V[cpu->opcode & 0x0F00]) = (cpu->opcode & 0x00FF);
+			cpu->V[x] = nn;
 			cpu->pc += 2;
 			break;
 		case 0x7000: // 7XNN: Vx += NN
-			(cpu->V[cpu->opcode & 0x0F00]) += (cpu->opcode & 0x00FF);
+			cpu->V[x] += nn;
 			cpu->pc += 2;
 			break;
 		case 0x8000:
-			uint8_t x = (cpu->opcode & 0x0F00) >> 8;
-			uint8_t y = (cpu->opcode & 0x00F0) >> 4;
-			switch(cpu->opcode & 0x000F)
+			switch(opcode & 0x000F)
 			{
 				case 0x0000: // 8XY0: Set VX to value of VY
 					cpu->V[x] = cpu->V[y];
 					break;
 				case 0x0001: // 8XY1: Set VX to VX OR VY  (VX |= VY)
 					cpu->V[x] |= cpu->V[y];
+					if (QUIRK(VF_RESET))
+						cpu->V[0xF] = 0;
 					break;
 				case 0x0002: // 8XY2: Set VX to VX AND VY (VX &= VY)
 					cpu->V[x] &= cpu->V[y];
+					if (QUIRK(VF_RESET))
+						cpu->V[0xF] = 0;
 					break;
 				case 0x0003: // 8XY3: Set VX to VX XOR VY (VX ^= VY)
 					cpu->V[x] ^= cpu->V[y];
+					if (QUIRK(VF_RESET))
+						cpu->V[0xF] = 0;
 					break;
+
+				// The flag is written after the result so that VF ends up
+				// holding the flag when X is F
 				case 0x0004: // 8XY4: Add VY to VX. VF is set to 1 when there's an overflow (greater than 255), and 0 if not.
-					cpu->V[x] += cpu->V[y];
-					cpu->V[0xF] = (cpu->V[x] > 0xFF) ? 1 : 0;
+				{
+					uint16_t sum = cpu->V[x] + cpu->V[y];
+					cpu->V[x] = (uint8_t)sum;
+					cpu->V[0xF] = (sum > 0xFF) ? 1 : 0;
 					break;
+				}
 				case 0x0005: // 8XY5: VY subtracted from VX. VF = 0 when there's underflow, and 1 when there's not. 
-					if (cpu->V[x] - cpu->V[y] < 0)
-						cpu->V[0xF] = 0;
-					else
-						cpu->V[0xF] = 1;
-
+				{
+					uint8_t flag = cpu->V[x] >= cpu->V[y];
 					cpu->V[x] -= cpu->V[y];
+					cpu->V[0xF] = flag;
 					break;
-				case 0x0006: // 8XY6: Shifts VX to the right by 1, then stores the LSB of VX prior to the shift into VF
-					cpu->V[0xF] = cpu->V[x] & 0x01;
-					cpu->V[x] >>= 1;
+				}
+				case 0x0006: // 8XY6: Shifts VX (VY with the SHIFT_VY quirk) right by 1 into VX, then stores the LSB prior to the shift into VF
+				{
+					uint8_t src = QUIRK(SHIFT_VY) ? cpu->V[y] : cpu->V[x];
+					cpu->V[x] = src >> 1;
+					cpu->V[0xF] = src & 0x01;
 					break;
+				}
 				case 0x0007: // 8XY7: VX = VY - VX. VF = 0 if underflow, otherwise VF = 1.
-					cpu->V[0xF] = cpu->V[x] > cpu->V[y] ? 0 : 1;
+				{
+					uint8_t flag = cpu->V[y] >= cpu->V[x];
 					cpu->V[x] = cpu->V[y] - cpu->V[x];
+					cpu->V[0xF] = flag;
 					break;
-				case 0x000E: // 8XYE: Shift VX to the left by 1. Set VF to 1 if the MSB of VX prior to shift was set, or 0 if it was unset
-					cpu->V[0xF] = (cpu->V[x] & 0x80) >> 7;
-					cpu->V[x] <<= 1;
+				}
+				case 0x000E: // 8XYE: Shift VX (VY with the SHIFT_VY quirk) left by 1 into VX. Set VF to 1 if the MSB prior to shift was set, or 0 if it was unset
+				{
+					uint8_t src = QUIRK(SHIFT_VY) ? cpu->V[y] : cpu->V[x];
+					cpu->V[x] = src << 1;
+					cpu->V[0xF] = (src & 0x80) >> 7;
 					break;
+				}
 			}
 			cpu->pc += 2;
 			break;
 
 		case 0x9000: // 9XY0: Skips the next instruction if VX != VY.
-			if ((cpu->V[cpu->opcode & 0x0F00]) != cpu->V[cpu->opcode & 0x00F0])
-				cpu->pc += 4;
-			else
-				cpu->pc += 2;
+			if (cpu->V[x] != cpu->V[y])
+				cpu->pc += next_size(cpu);
+			cpu->pc += 2;
 			break;
 
 		case 0xA000: // ANNN: LD I, addr
-			cpu->ir = cpu->opcode & 0x0FFF;
+			cpu->ir = nnn;
 			cpu->pc += 2;
 			break;
-		case 0xB000: // BNNN: Jumps to address NNN + V0. PC = V0 + NNN
-			cpu->pc = (cpu->opcode & 0x0FFF) + cpu->V[0];
+		case 0xB000: // BNNN: Jumps to address NNN + V0. PC = V0 + NNN (BXNN: XNN + VX with the JUMP_VX quirk)
+			cpu->pc = nnn + (QUIRK(JUMP_VX) ? cpu->V[x] : cpu->V[0]);
 			break;
 		case 0xC000: // CXNN: VX = (NN & randomNumber)
-			int r = rand() % RAND_MAX;
-			cpu->V[cpu->opcode & 0x0F00] = ((cpu->opcode & 0x00FF) & r);
+			cpu->rng ^= cpu->rng << 13;
+			cpu->rng ^= cpu->rng >> 17;
+			cpu->rng ^= cpu->rng << 5;
+			cpu->V[x] = nn & (cpu->rng >> 24);
+			cpu->pc += 2;
 			break;
-		case 0xD000: // DXYN: draw(Vx, Vy, N)
-			uint8_t x_coord = cpu->V[(cpu->opcode & 0x0F00) >> 8];
-			uint8_t y_coord = cpu->V[(cpu->opcode & 0x00F0) >> 4];
-			uint8_t height  = cpu->opcode & 0x000F;
-
-			cpu->V[0xF] = 0; // reset collision flag
-
-			for (int row = 0; row < height; row++)
+		case 0xD000: // DXYN: draw(Vx, Vy, N). DXY0 draws a 16x16 sprite on SUPER-CHIP
+			cpu->V[0xF] = draw(cpu, cpu->V[x], cpu->V[y], cpu->ir, opcode & 0x000F, quirks);
+			cpu->pc += 2;
+			break;
+		case 0xE000:
+			switch (nn)
 			{
-				uint8_t sprite_byte = cpu->memory[cpu->ir + row];
-
-				for (int col = 0; col < 8; col++)
-				{
-					if ((sprite_byte & (0x80 >> col)) != 0) // check if pixel in sprite is set
-					{
-						int x = (x_coord + col) % 64;
-						int y = (y_coord + row) % 32;
-						int index = (y * 64) + x;
-
-						if (cpu->display[index] == 1)
-						{
-							cpu->V[0xF] = 1; 
-						}
-						cpu->display[index] ^= 1; // xor pixel
-					}
-				}
+				case 0x9E: // EX9E: if (key() == Vx): Skips the next instruction if the key stored in VX (only consider the lowest nibble) is pressed.
+					if (cpu->keypad[cpu->V[x] & 0xF])
+						cpu->pc += next_size(cpu);
+					break;
+				case 0xA1: // EXA1: if (key() != VX): Skips the next instruction if the key stored in VX (only consider the lowest nibble) is not pressed.
+					if (!cpu->keypad[cpu->V[x] & 0xF])
+						cpu->pc += next_size(cpu);
+					break;
+				default:
+					printf("Error: unknown opcode: %x", opcode);
+					break;
 			}
-			cpu->draw_flag = 1;
 			cpu->pc += 2;
 			break;
-		case 0xE000: 
-			switch (cpu->opcode & 0x000F)
+		case 0xF000:
+			if (opcode == 0xF000 && cpu->platform == CHIP8_PLATFORM_XOCHIP) // F000 NNNN: XO-CHIP, I = NNNN
+			{
+				cpu->ir = (chip8_read(cpu, cpu->pc + 2) << 8) | chip8_read(cpu, cpu->pc + 3);
+				cpu->pc += 4;
+				break;
+			}
+
+			switch (nn)
 			{
-				case 0x000E: // EX9E: if (key() == Vx): Skips the next instruction if the key stored in VX (only consider the lowest nibble) is pressed.
-					printf("0xEX9E: INSTRUCTION NOT IMPLEMENTED\n");
+				case 0x07: // FX07: VX = delay timer
+					cpu->V[x] = cpu->delay_timer;
+					break;
+				case 0x0A: // FX0A: wait for a key press and release, then store the key in VX (see chip8_set_keys())
+					cpu->waiting = 1;
+					cpu->wait_reg = x;
+					break;
+				case 0x15: // FX15: delay timer = VX
+					cpu->delay_timer = cpu->V[x];
+					break;
+				case 0x18: // FX18: sound timer = VX
+					cpu->sound_timer = cpu->V[x];
+					break;
+				case 0x1E: // FX1E: I += VX
+					cpu->ir += cpu->V[x];
+					break;
+				case 0x29: // FX29: I = address of the 4x5 font digit in VX
+					cpu->ir = CHIP8_FONT_ADDR + (cpu->V[x] & 0xF) * 5;
+					break;
+				case 0x33: // FX33: store the decimal digits of VX at I, I+1 and I+2
+					chip8_write_block(cpu, cpu->ir, bcd[cpu->V[x]], 3);
+					break;
+				case 0x55: // FX55: store V0..VX at I (I ends up past them with the MEM_INC_I quirk)
+					chip8_write_block(cpu, cpu->ir, cpu->V, x + 1);
+					if (QUIRK(MEM_INC_I))
+						cpu->ir += x + 1;
+					break;
+				case 0x65: // FX65: load V0..VX from I
+					chip8_read_block(cpu, cpu->ir, cpu->V, x + 1);
+					if (QUIRK(MEM_INC_I))
+						cpu->ir += x + 1;
 					break;
-				case 0x0001: // EXA1: if (key() != VX): Skips the next instruction if the key stored in VX (only consider the lowest nibble) is not pressed.
-					printf("0xEXA1: INSTRUCTION NOT IMPLEMENTED\n");
+				case 0x01: // FN01: XO-CHIP, select bitplanes N for drawing, scrolling and CLS
+					if (cpu->platform != CHIP8_PLATFORM_XOCHIP)
+						goto unknown_f;
+					cpu->planes = x & 0x3;
 					break;
+				case 0x02: // F002: XO-CHIP, load the 16-byte audio pattern from I
+					if (cpu->platform != CHIP8_PLATFORM_XOCHIP || x != 0)
+						goto unknown_f;
+					for (int i = 0; i < 16; i++)
+						cpu->pattern[i] = chip8_read(cpu, cpu->ir + i);
+					break;
+				case 0x3A: // FX3A: XO-CHIP, audio pitch = VX
+					if (cpu->platform != CHIP8_PLATFORM_XOCHIP)
+						goto unknown_f;
+					cpu->pitch = cpu->V[x];
+					break;
+				case 0x30: // FX30: SCHIP: I = address of the 8x10 font digit in VX
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown_f;
+					cpu->ir = CHIP8_BIG_FONT_ADDR + (cpu->V[x] & 0xF) * 10;
+					break;
+				case 0x75: // FX75: SCHIP: save V0..VX to the RPL user flags (XO-CHIP allows all 16)
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown_f;
+					memcpy(cpu->rpl, cpu->V, x + 1);
+					break;
+				case 0x85: // FX85: SCHIP: restore V0..VX from the RPL user flags
+					if (cpu->platform == CHIP8_PLATFORM_CHIP8)
+						goto unknown_f;
+					memcpy(cpu->V, cpu->rpl, x + 1);
+					break;
+				default:
+				unknown_f:
+					printf("Error: unknown opcode: %x", opcode);
+					break;
+			}
+			cpu->pc += 2;
+			break;
+	}
+}
+
+#undef QUIRK
+
+#define DEFINE_STEP(q) static void step_##q(chip8_t* cpu) { execute(cpu, q); }
+DEFINE_STEP(0)  DEFINE_STEP(1)  DEFINE_STEP(2)  DEFINE_STEP(3)  DEFINE_STEP(4)  DEFINE_STEP(5)  DEFINE_STEP(6)  DEFINE_STEP(7)
+DEFINE_STEP(8)  DEFINE_STEP(9)  DEFINE_STEP(10) DEFINE_STEP(11) DEFINE_STEP(12) DEFINE_STEP(13) DEFINE_STEP(14) DEFINE_STEP(15)
+DEFINE_STEP(16) DEFINE_STEP(17) DEFINE_STEP(18) DEFINE_STEP(19) DEFINE_STEP(20) DEFINE_STEP(21) DEFINE_STEP(22) DEFINE_STEP(23)
+DEFINE_STEP(24) DEFINE_STEP(25) DEFINE_STEP(26) DEFINE_STEP(27) DEFINE_STEP(28) DEFINE_STEP(29) DEFINE_STEP(30) DEFINE_STEP(31)
+#undef DEFINE_STEP
+
+static void (*const step_table[1 << CHIP8_QUIRK_COUNT])(chip8_t*) = {
+	step_0,  step_1,  step_2,  step_3,  step_4,  step_5,  step_6,  step_7,
+	step_8,  step_9,  step_10, step_11, step_12, step_13, step_14, step_15,
+	step_16, step_17, step_18, step_19, step_20, step_21, step_22, step_23,
+	step_24, step_25, step_26, step_27, step_28, step_29, step_30, step_31,
+};
+
+void emulate_cycle(chip8_t* cpu)
+{
+	cpu->step(cpu);
+}
+
+// Decode cache ops. Anything without its own op runs through execute().
+enum {
+	UOP_NONE,
+	UOP_EXEC,
+	UOP_RET,     // 00EE
+	UOP_JP,      // 1NNN
+	UOP_CALL,    // 2NNN
+	UOP_SE,      // 3XKK, n = bytes to advance when skipping
+	UOP_SNE,     // 4XKK
+	UOP_SE_REG,  // 5XY0
+	UOP_SNE_REG, // 9XY0
+	UOP_LD,      // 6XKK
+	UOP_ADD,     // 7XKK
+	UOP_LD_I,    // ANNN
+	UOP_DRAW,    // DXYN
+
+	// Fused sequences that turn up all over ROMs
+	UOP_LD_I_DRAW, // ANNN DXYN: select a sprite and draw it
+	UOP_LD_LD,     // 6XKK 6YNN: set up coordinates, y and n hold the second load
+	UOP_LOOP,      // 7XKK 3XNN 1NNN: loop counter, n holds the limit
+	UOP_WAIT,      // FX07 3XNN 1NNN: poll the delay timer, n holds the value waited for
+};
+
+static inline uint16_t fetch(const chip8_t* cpu, uint16_t addr)
+{
+	return (chip8_read(cpu, addr) << 8) | chip8_read(cpu, addr + 1);
+}
+
+// A group can't be fused when the frame loop has to stop in the middle of it
+static inline int fusable(const chip8_t* cpu, uint16_t addr, int count)
+{
+	return cpu->idle_pc <= addr || cpu->idle_pc >= addr + count * 2;
+}
+
+static const chip8_uop_t* decode(chip8_t* cpu, uint16_t addr)
+{
+	chip8_uop_t** uops = &cpu->uops[addr >> CHIP8_PAGE_SHIFT];
+	if (*uops == no_uops)
+	{
+		*uops = calloc(CHIP8_PAGE_SIZE, sizeof(**uops));
+		if (!*uops)
+		{
+			printf("Could not allocate decode cache\n");
+			abort();
+		}
+	}
+
+	chip8_uop_t* uop = &(*uops)[addr & (CHIP8_PAGE_SIZE - 1)];
+	uint16_t opcode = fetch(cpu, addr);
+	uint16_t next = fetch(cpu, addr + 2);
+	uint16_t third = fetch(cpu, addr + 4);
+	uint8_t x = (opcode & 0x0F00) >> 8;
+
+	uop->op = UOP_EXEC;
+	uop->count = 1;
+	uop->x = x;
+	uop->y = (opcode & 0x00F0) >> 4;
+	uop->n = opcode & 0x000F;
+	uop->kk = opcode & 0x00FF;
+	uop->nnn = opcode & 0x0FFF;
+
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+			if (opcode == 0x00EE)
+				uop->op = UOP_RET;
+			break;
+		case 0x1000:
+			uop->op = UOP_JP;
+			break;
+		case 0x2000:
+			uop->op = UOP_CALL;
+			break;
+		case 0x3000:
+		case 0x4000:
+			uop->op = (opcode & 0xF000) == 0x3000 ? UOP_SE : UOP_SNE;
+			uop->n = 2 + instruction_size(cpu, addr + 2);
+			break;
+		case 0x5000:
+		case 0x9000:
+			if (opcode & 0x000F)
+				break;
+			uop->op = (opcode & 0xF000) == 0x5000 ? UOP_SE_REG : UOP_SNE_REG;
+			uop->n = 2 + instruction_size(cpu, addr + 2);
+			break;
+		case 0x6000:
+			uop->op = UOP_LD;
+			if ((next & 0xF000) == 0x6000 && fusable(cpu, addr, 2))
+			{
+				uop->op = UOP_LD_LD;
+				uop->count = 2;
+				uop->y = (next & 0x0F00) >> 8;
+				uop->n = next & 0x00FF;
 			}
 			break;
+		case 0x7000:
+			uop->op = UOP_ADD;
+			if ((next & 0xFF00) == (0x3000 | x << 8) && (third & 0xF000) == 0x1000 && fusable(cpu, addr, 3))
+			{
+				uop->op = UOP_LOOP;
+				uop->count = 3;
+				uop->n = next & 0x00FF;
+				uop->nnn = third & 0x0FFF;
+			}
+			break;
+		case 0xA000:
+			uop->op = UOP_LD_I;
+			if ((next & 0xF000) == 0xD000 && fusable(cpu, addr, 2))
+			{
+				uop->op = UOP_LD_I_DRAW;
+				uop->count = 2;
+				uop->x = (next & 0x0F00) >> 8;
+				uop->y = (next & 0x00F0) >> 4;
+				uop->n = next & 0x000F;
+			}
+			break;
+		case 0xD000:
+			uop->op = UOP_DRAW;
+			break;
+		case 0xF000:
+			if ((opcode & 0x00FF) == 0x07 && (next & 0xFF00) == (0x3000 | x << 8) && (third & 0xF000) == 0x1000 && fusable(cpu, addr, 3))
+			{
+				uop->op = UOP_WAIT;
+				uop->count = 3;
+				uop->n = next & 0x00FF;
+				uop->nnn = third & 0x0FFF;
+			}
+			break;
+	}
+
+	// Writes to any byte this entry read have to find it
+	unsigned int first = addr >> CHIP8_PAGE_SHIFT;
+	unsigned int last = ((addr + UOP_SPAN - 1) & cpu->mem_mask) >> CHIP8_PAGE_SHIFT;
+	cpu->decoded[first >> 6] |= 1ull << (first & 63);
+	cpu->decoded[last >> 6] |= 1ull << (last & 63);
+	cpu->trap[first >> 6] |= 1ull << (first & 63);
+	cpu->trap[last >> 6] |= 1ull << (last & 63);
+	return uop;
+}
+
+// Runs up to budget instructions from the decode cache. Returns the number
+// of instructions executed; a fused group counts as all of its
+// instructions, so results match calling emulate_cycle() the same number of
+// times. See emulate_cycles() for when it stops early.
+//
+// The registers live in locals for the whole run. Nothing the cached ops do
+// can alias them, so the compiler keeps them in machine registers instead of
+// reloading through cpu after every store to memory or the display. They
+// are written back to cpu around anything that falls back to execute(), and
+// on exit.
+static CHIP8_ALWAYS_INLINE int run(chip8_t* cpu, int budget, const unsigned int quirks)
+{
+	chip8_uop_t* const* uops = cpu->uops;
+	unsigned int page = ~0u; // page whose entries are in page_uops
+	const chip8_uop_t* page_uops = NULL;
+	const uint16_t mem_mask = cpu->mem_mask;
+	const int idle_pc = cpu->idle_pc;
+	const int drawn = cpu->draw_flag;
+	int done = 0;
+	int stop = cpu->halted || cpu->waiting;
+
+	uint16_t pc = cpu->pc;
+	uint16_t ir = cpu->ir;
+	uint16_t sp = cpu->sp;
+	uint8_t V[16];
+	memcpy(V, cpu->V, sizeof(V));
+
+#define SPILL() (cpu->pc = pc, cpu->ir = ir, cpu->sp = sp, memcpy(cpu->V, V, sizeof(V)))
+#define RELOAD() (pc = cpu->pc, ir = cpu->ir, sp = cpu->sp, memcpy(V, cpu->V, sizeof(V)))
+
+	// Only draws and instructions that fall back to execute() can end the
+	// run early, so only they raise stop
+	while (!stop && done < budget)
+	{
+		uint16_t addr = pc & mem_mask;
+		if (addr >> CHIP8_PAGE_SHIFT != page)
+		{
+			page = addr >> CHIP8_PAGE_SHIFT;
+			page_uops = uops[page];
+		}
+		const chip8_uop_t* uop = &page_uops[addr & (CHIP8_PAGE_SIZE - 1)];
+		if (uop->op == UOP_NONE)
+		{
+			uop = decode(cpu, addr); // may have allocated the page's entries
+			page_uops = uops[page];
+		}
+
+		// A fused group only runs whole; when the budget can't cover it
+		// the first instruction runs on its own through execute()
+		int op = uop->op;
+		if (uop->count > budget - done)
+			op = UOP_EXEC;
+		done += op == UOP_EXEC ? 1 : uop->count;
+
+		switch (op)
+		{
+			case UOP_RET:
+				sp = (sp - 1) & 15; // wraps the same way as execute()
+				pc = cpu->stack[sp] + 2;
+				break;
+			case UOP_JP:
+				pc = uop->nnn;
+				break;
+			case UOP_CALL:
+				cpu->stack[sp] = pc;
+				sp = (sp + 1) & 15;
+				pc = uop->nnn;
+				break;
+			case UOP_SE:
+				pc += V[uop->x] == uop->kk ? uop->n : 2;
+				break;
+			case UOP_SNE:
+				pc += V[uop->x] != uop->kk ? uop->n : 2;
+				break;
+			case UOP_SE_REG:
+				pc += V[uop->x] == V[uop->y] ? uop->n : 2;
+				break;
+			case UOP_SNE_REG:
+				pc += V[uop->x] != V[uop->y] ? uop->n : 2;
+				break;
+			case UOP_LD:
+				V[uop->x] = uop->kk;
+				pc += 2;
+				break;
+			case UOP_ADD:
+				V[uop->x] += uop->kk;
+				pc += 2;
+				break;
+			case UOP_LD_I:
+				ir = uop->nnn;
+				pc += 2;
+				break;
+			case UOP_DRAW:
+				V[0xF] = draw(cpu, V[uop->x], V[uop->y], ir, uop->n, quirks);
+				pc += 2;
+				stop = !drawn;
+				break;
+			case UOP_LD_I_DRAW:
+				ir = uop->nnn;
+				V[0xF] = draw(cpu, V[uop->x], V[uop->y], ir, uop->n, quirks);
+				pc += 4;
+				stop = !drawn;
+				break;
+			case UOP_LD_LD:
+				V[uop->x] = uop->kk;
+				V[uop->y] = uop->n;
+				pc += 4;
+				break;
+
+			// Leaving either loop skips the jump, so only two of the
+			// three instructions ran
+			case UOP_LOOP:
+				V[uop->x] += uop->kk;
+				if (V[uop->x] == uop->n)
+				{
+					pc += 6;
+					done--;
+					break;
+				}
+				pc = uop->nnn;
+				break;
+			case UOP_WAIT:
+				V[uop->x] = cpu->delay_timer;
+				if (V[uop->x] == uop->n)
+				{
+					pc += 6;
+					done--;
+					break;
+				}
+				pc = uop->nnn;
+
+				// A loop straight back to itself can't get anywhere until
+				// the timers tick, so spend the rest of the budget in
+				// whole iterations
+				if (uop->nnn == addr && addr != idle_pc)
+					done += (budget - done) / 3 * 3;
+				break;
+			default:
+				// Called out of line: inlining the whole interpreter here
+				// would crowd the cached registers out of the loop
+				SPILL();
+				step_table[quirks](cpu);
+				RELOAD();
+				stop = cpu->halted || cpu->waiting || cpu->watch_hit || cpu->draw_flag != drawn;
+				break;
+		}
+
+		if (pc == idle_pc) // nothing left to do until the next timer tick
+			break;
+	}
+
+	SPILL();
+#undef SPILL
+#undef RELOAD
+	return done;
+}
+
+#define DEFINE_RUN(q) static int run_##q(chip8_t* cpu, int budget) { return run(cpu, budget, q); }
+DEFINE_RUN(0)  DEFINE_RUN(1)  DEFINE_RUN(2)  DEFINE_RUN(3)  DEFINE_RUN(4)  DEFINE_RUN(5)  DEFINE_RUN(6)  DEFINE_RUN(7)
+DEFINE_RUN(8)  DEFINE_RUN(9)  DEFINE_RUN(10) DEFINE_RUN(11) DEFINE_RUN(12) DEFINE_RUN(13) DEFINE_RUN(14) DEFINE_RUN(15)
+DEFINE_RUN(16) DEFINE_RUN(17) DEFINE_RUN(18) DEFINE_RUN(19) DEFINE_RUN(20) DEFINE_RUN(21) DEFINE_RUN(22) DEFINE_RUN(23)
+DEFINE_RUN(24) DEFINE_RUN(25) DEFINE_RUN(26) DEFINE_RUN(27) DEFINE_RUN(28) DEFINE_RUN(29) DEFINE_RUN(30) DEFINE_RUN(31)
+#undef DEFINE_RUN
+
+static int (*const run_table[1 << CHIP8_QUIRK_COUNT])(chip8_t*, int) = {
+	run_0,  run_1,  run_2,  run_3,  run_4,  run_5,  run_6,  run_7,
+	run_8,  run_9,  run_10, run_11, run_12, run_13, run_14, run_15,
+	run_16, run_17, run_18, run_19, run_20, run_21, run_22, run_23,
+	run_24, run_25, run_26, run_27, run_28, run_29, run_30, run_31,
+};
+
+// Runs up to budget instructions through the decode cache, whose entries are
+// allocated a page at a time as code there is first decoded, and returns how
+// many ran. It returns early:
+// - at the idle loop (see chip8_set_idle_pc())
+// - after the first draw while draw_flag is clear, so a caller can present
+// - on a trap: a halt, or a write to a watched address
+// - when FX0A starts waiting for a key
+int emulate_cycles(chip8_t* cpu, int budget)
+{
+	if (!cpu->uops)
+	{
+		size_t pages = chip8_get_mem_size(cpu) / CHIP8_PAGE_SIZE;
+		cpu->uops = malloc(pages * sizeof(*cpu->uops));
+		if (!cpu->uops)
+		{
+			printf("Could not allocate decode cache\n");
+			abort();
+		}
+		for (size_t i = 0; i < pages; i++)
+			cpu->uops[i] = no_uops;
+	}
+	return run_table[cpu->quirks](cpu, budget);
+}
+
+// Runs one 60 Hz frame: the timers tick, then up to cycles_per_frame
+// instructions run. Draws don't end the frame; reaching the idle loop or a
+// trap does. Returns the number of instructions executed.
+int emulate_frame(chip8_t* cpu)
+{
+	int done = 0;
+
+	update_timers(cpu);
+	while (done < cpu->cycles_per_frame)
+	{
+		done += emulate_cycles(cpu, cpu->cycles_per_frame - done);
+		if (cpu->halted || cpu->waiting || cpu->watch_hit || cpu->pc == cpu->idle_pc)
+			break;
+	}
+	return done;
+}
+
+void chip8_set_cycles_per_frame(chip8_t* cpu, int cycles)
+{
+	cpu->cycles_per_frame = cycles;
+}
+
+// Tells emulate_cycles() where the program idles. Fusing depends on it, so
+// the decode cache starts over.
+void chip8_set_idle_pc(chip8_t* cpu, int pc)
+{
+	cpu->idle_pc = pc;
+	if (!cpu->uops)
+		return;
+	for (size_t i = 0; i < chip8_get_mem_size(cpu) / CHIP8_PAGE_SIZE; i++)
+	{
+		if (cpu->uops[i] != no_uops)
+			memset(cpu->uops[i], 0, CHIP8_PAGE_SIZE * sizeof(*cpu->uops[i]));
 	}
 }
 
+unsigned int chip8_default_quirks(chip8_platform_t platform)
+{
+	switch (platform)
+	{
+		case CHIP8_PLATFORM_SCHIP:
+			return CHIP8_QUIRK_JUMP_VX | CHIP8_QUIRK_CLIP;
+		case CHIP8_PLATFORM_XOCHIP:
+			return CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_MEM_INC_I;
+		default: // COSMAC VIP
+			return CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_MEM_INC_I | CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_CLIP;
+	}
+}
+
+void chip8_set_quirks(chip8_t* cpu, unsigned int quirks)
+{
+	cpu->quirks = quirks & ((1u << CHIP8_QUIRK_COUNT) - 1);
+	cpu->step = step_table[cpu->quirks];
+}
+
 void clear_screen(chip8_t* cpu)
 {
-	memset(cpu->display, 0, sizeof(cpu->display));
+	cpu->dirty = CHIP8_ALL_ROWS;
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		if (cpu->planes & (1 << p))
+			memset(cpu->display[p], 0, sizeof(cpu->display[p]));
+	}
 }
 
+// Called once per 60 Hz frame
 void update_timers(chip8_t* cpu)
 {
-	printf("update_timers() NOT IMPLEMENTED YET.\n");
+	if (cpu->delay_timer)
+		cpu->delay_timer--;
+	if (cpu->sound_timer)
+		cpu->sound_timer--;
+}
+
+// Updates the keypad from a mask with bit n set while key n is held. Like
+// the COSMAC VIP, FX0A completes when a key is released, so a key going up
+// while the CPU waits is stored in the waiting register.
+void chip8_set_keys(chip8_t* cpu, uint16_t keys)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		uint8_t down = (keys >> i) & 1;
+		if (cpu->waiting && cpu->keypad[i] && !down)
+		{
+			cpu->V[cpu->wait_reg] = i;
+			cpu->waiting = 0;
+		}
+		cpu->keypad[i] = down;
+	}
+}
+
+// Seeds CXNN. Every seed, including 0, gives a usable sequence.
+void chip8_set_seed(chip8_t* cpu, uint32_t seed)
+{
+	cpu->rng = seed ^ 0x2545F491; // xorshift state must never be 0
+	if (!cpu->rng)
+		cpu->rng = 0x2545F491;
+}
+
+size_t chip8_get_mem_size(const chip8_t* cpu)
+{
+	return (size_t)cpu->mem_mask + 1;
+}
+
+// Rows of the display (bit n = row n) changed since the last chip8_clear_dirty()
+uint64_t chip8_get_dirty(const chip8_t* cpu)
+{
+	return cpu->dirty;
+}
+
+void chip8_clear_dirty(chip8_t* cpu)
+{
+	cpu->dirty = 0;
+}
+
+int chip8_get_width(const chip8_t* cpu)
+{
+	return cpu->hires ? CHIP8_HIRES_WIDTH : CHIP8_LORES_WIDTH;
+}
+
+int chip8_get_height(const chip8_t* cpu)
+{
+	return cpu->hires ? CHIP8_HIRES_HEIGHT : CHIP8_LORES_HEIGHT;
 }
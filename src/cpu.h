@@ -1,28 +1,178 @@
 #ifndef _CHIP8_H
 #define _CHIP8_H
+#include <stddef.h>
 #include <stdint.h>
 
-typedef struct {
-	uint16_t opcode; 
-	uint8_t memory[4096];
-	uint8_t V[16]; // 16 8-bit Registers. V0 - VF; VF doubles as a carry flag
-	
+#define CHIP8_MEM_SIZE 4096
+#define CHIP8_XO_MEM_SIZE 65536 // XO-CHIP address space
+#define CHIP8_PROG_START 0x200
+#define CHIP8_MAX_ROM_SIZE (CHIP8_MEM_SIZE - CHIP8_PROG_START)
+
+// Memory is addressed through a table of 256-byte pages so that clones can
+// share the pages of a template and only copy the ones they write to.
+#define CHIP8_PAGE_SHIFT 8
+#define CHIP8_PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+#define CHIP8_PAGES (CHIP8_MEM_SIZE / CHIP8_PAGE_SIZE)
+#define CHIP8_MAX_PAGES (CHIP8_XO_MEM_SIZE / CHIP8_PAGE_SIZE)
+
+#define CHIP8_CACHE_LINE 64
+
+// The display is always stored at SUPER-CHIP resolution as 64 rows of two
+// 64-bit words, leftmost pixel in the MSB of word 0. Low-res mode uses the
+// top-left 64x32 corner, so a lo-res row is exactly display[p][y][0].
+// XO-CHIP adds a second bitplane; plane 0 is the classic display.
+#define CHIP8_LORES_WIDTH 64
+#define CHIP8_LORES_HEIGHT 32
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+#define CHIP8_PLANES 2
+#define CHIP8_ALL_ROWS (~0ull) // dirty mask covering every row
+
+#define CHIP8_DEFAULT_CYCLES_PER_FRAME 11 // ~660 instructions per second at 60 frames
+
+#define CHIP8_FONT_ADDR 0x000
+#define CHIP8_BIG_FONT_ADDR 0x050
+
+#ifdef _MSC_VER
+#define CHIP8_ALWAYS_INLINE __forceinline
+#else
+#define CHIP8_ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
+
+// Behaviours that differ between CHIP-8 variants. A quirk set is picked when
+// the CPU is initialized and selects an interpreter specialized for it.
+#define CHIP8_QUIRK_SHIFT_VY  (1u << 0) // 8XY6/8XYE shift VY into VX instead of shifting VX in place
+#define CHIP8_QUIRK_MEM_INC_I (1u << 1) // FX55/FX65 leave I pointing past the last register
+#define CHIP8_QUIRK_JUMP_VX   (1u << 2) // BNNN is BXNN: jump to XNN + VX instead of NNN + V0
+#define CHIP8_QUIRK_VF_RESET  (1u << 3) // 8XY1/8XY2/8XY3 clear VF
+#define CHIP8_QUIRK_CLIP      (1u << 4) // DXYN clips sprites at the screen edges instead of wrapping
+#define CHIP8_QUIRK_COUNT 5
+
+// Per-address debugger flags, see chip8_set_watch()
+#define CHIP8_DEBUG_BREAK 0x01 // stop before executing the instruction here
+#define CHIP8_DEBUG_WATCH 0x02 // stop after a write here
+
+typedef enum {
+	CHIP8_PLATFORM_CHIP8,
+	CHIP8_PLATFORM_SCHIP,
+	CHIP8_PLATFORM_XOCHIP,
+} chip8_platform_t;
+
+typedef struct chip8 chip8_t;
+typedef struct chip8_uop chip8_uop_t;
+
+// The struct is laid out hot to cold: the register file a cycle touches
+// lives in the first cache line, followed by the call stack, the
+// framebuffer, and everything else.
+struct chip8 {
+	_Alignas(CHIP8_CACHE_LINE) uint8_t V[16]; // 16 8-bit Registers. V0 - VF; VF doubles as a carry flag
+
 	// These can both only address 12 bits even though they're 16 bits long
+	// (XO-CHIP uses all 16)
 	uint16_t ir; // index register
 	uint16_t pc; // program counter
-	uint16_t stack[16];
-	uint16_t sp; 
+	uint16_t sp;
+	uint16_t mem_mask; // memory size - 1
+	uint8_t** page; // mem_mask / CHIP8_PAGE_SIZE + 1 entries
 	uint8_t delay_timer; // decremented at 60hz until zero
 	uint8_t sound_timer; // functions same as delay timer but beeps if not zero
-	uint8_t display[64*32];
-	uint8_t keypad[16];
-	unsigned char key;
 	uint8_t draw_flag; // bool
-} chip8_t;
+	unsigned char key;
+	uint8_t hires; // bool, 128x64 SUPER-CHIP mode
+	uint8_t platform; // chip8_platform_t
+	uint8_t planes; // XO-CHIP bitplane select mask, 1 on other platforms
+	void (*step)(chip8_t* cpu); // interpreter specialized for the current quirks
+	uint64_t dirty; // bit n is set when display row n changed, cleared by the consumer
+	chip8_uop_t** uops; // decode cache for emulate_cycles(), one table of entries per page, NULL until first used
 
-void init_cpu(chip8_t* cpu);
+	_Alignas(CHIP8_CACHE_LINE) uint16_t stack[16];
+	_Alignas(CHIP8_CACHE_LINE) uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+
+	// Cold
+	uint8_t keypad[16];
+	uint8_t rpl[16]; // SUPER-CHIP RPL user flags, saved and restored by FX75/FX85
+	uint8_t pattern[16]; // XO-CHIP 1-bit audio pattern, loaded by F002
+	uint8_t pitch; // XO-CHIP audio pitch, set by FX3A
+	uint8_t halted; // bool, set by 00FD
+	uint8_t waiting; // bool, set by FX0A until a key is released
+	uint8_t wait_reg; // the X of the FX0A being waited on
+	uint32_t rng; // xorshift state for CXNN, so instances on different threads don't share rand()
+	unsigned int quirks; // CHIP8_QUIRK_* flags
+	uint64_t shared[CHIP8_MAX_PAGES / 64]; // bit n is set while page n still belongs to the template
+	uint64_t trap[CHIP8_MAX_PAGES / 64]; // bit n sends writes to page n through chip8_write_slow()
+	uint64_t decoded[CHIP8_MAX_PAGES / 64]; // bit n is set once the decode cache holds instructions reading page n
+	int idle_pc; // address of the program's idle loop, -1 if unknown; emulate_cycles() stops there
+	int cycles_per_frame; // instructions emulate_frame() runs
+	const uint8_t* watch; // debugger flags per address, NULL when not debugging
+	uint16_t watch_addr; // last watched address written
+	uint8_t watch_hit; // bool, set by a write to a watched address, cleared by the debugger
+	uint8_t* memory; // private backing store for every page, NULL for clones
+};
+
+_Static_assert(offsetof(chip8_t, stack) == CHIP8_CACHE_LINE, "chip8_t register file must fit in one cache line");
+
+int init_cpu(chip8_t* cpu);
+int chip8_init(chip8_t* cpu, chip8_platform_t platform);
+void free_cpu(chip8_t* cpu);
+int chip8_clone(chip8_t* dst, const chip8_t* tmpl);
 int load_rom(chip8_t* cpu, const char* filename);
+int chip8_load_rom_mem(chip8_t* cpu, const uint8_t* data, size_t len);
 void emulate_cycle(chip8_t* cpu);
+int emulate_cycles(chip8_t* cpu, int budget);
+int emulate_frame(chip8_t* cpu);
+void chip8_set_idle_pc(chip8_t* cpu, int pc);
+void chip8_set_cycles_per_frame(chip8_t* cpu, int cycles);
+unsigned int chip8_default_quirks(chip8_platform_t platform);
+void chip8_set_quirks(chip8_t* cpu, unsigned int quirks);
 void clear_screen(chip8_t* cpu);
 void update_timers(chip8_t* cpu);
+void chip8_set_keys(chip8_t* cpu, uint16_t keys);
+void chip8_set_seed(chip8_t* cpu, uint32_t seed);
+
+size_t chip8_get_mem_size(const chip8_t* cpu);
+uint64_t chip8_get_dirty(const chip8_t* cpu);
+void chip8_clear_dirty(chip8_t* cpu);
+int chip8_get_width(const chip8_t* cpu);
+int chip8_get_height(const chip8_t* cpu);
+
+void chip8_unshare_page(chip8_t* cpu, unsigned int page);
+void chip8_set_watch(chip8_t* cpu, const uint8_t* flags);
+void chip8_write_slow(chip8_t* cpu, uint16_t addr, uint8_t value);
+void chip8_write_block(chip8_t* cpu, uint16_t addr, const uint8_t* data, size_t len);
+void chip8_read_block(const chip8_t* cpu, uint16_t addr, uint8_t* out, size_t len);
+
+static inline uint8_t chip8_read(const chip8_t* cpu, uint16_t addr)
+{
+	addr &= cpu->mem_mask;
+	return cpu->page[addr >> CHIP8_PAGE_SHIFT][addr & (CHIP8_PAGE_SIZE - 1)];
+}
+
+static inline int chip8_page_shared(const chip8_t* cpu, unsigned int page)
+{
+	return (cpu->shared[page >> 6] >> (page & 63)) & 1;
+}
+
+static inline int chip8_page_decoded(const chip8_t* cpu, unsigned int page)
+{
+	return (cpu->decoded[page >> 6] >> (page & 63)) & 1;
+}
+
+static inline int chip8_page_trapped(const chip8_t* cpu, unsigned int page)
+{
+	return (cpu->trap[page >> 6] >> (page & 63)) & 1;
+}
+
+// Every store to emulated memory goes through here. Pages that need extra
+// work on a write (shared with a template, holding decoded instructions, or
+// watched by the debugger) are trapped and take the slow path; everything
+// else is a plain store.
+static inline void chip8_write(chip8_t* cpu, uint16_t addr, uint8_t value)
+{
+	addr &= cpu->mem_mask;
+	unsigned int page = addr >> CHIP8_PAGE_SHIFT;
+	if (chip8_page_trapped(cpu, page))
+		chip8_write_slow(cpu, addr, value);
+	else
+		cpu->page[page][addr & (CHIP8_PAGE_SIZE - 1)] = value;
+}
 #endif
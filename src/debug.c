@@ -0,0 +1,532 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+
+enum { OP_EQ, OP_NE, OP_LT, OP_GT, OP_LE, OP_GE };
+
+static const char* const op_names[] = { "==", "!=", "<", ">", "<=", ">=" };
+
+static int SDLCALL stdin_thread(void* data)
+{
+	debug_t* debug = data;
+	char line[DEBUG_LINE];
+
+	while (fgets(line, sizeof(line), stdin))
+	{
+		memcpy(debug->line, line, sizeof(line));
+		SDL_SignalSemaphore(debug->line_ready);
+		SDL_WaitSemaphore(debug->line_taken);
+	}
+	return 0;
+}
+
+static unsigned int read_reg(const chip8_t* cpu, int reg)
+{
+	switch (reg)
+	{
+	case DEBUG_REG_I: return cpu->ir;
+	case DEBUG_REG_DT: return cpu->delay_timer;
+	case DEBUG_REG_ST: return cpu->sound_timer;
+	case DEBUG_REG_SP: return cpu->sp;
+	default: return cpu->V[reg];
+	}
+}
+
+static int evaluate(const debug_condition_t* c, const chip8_t* cpu)
+{
+	unsigned int v = read_reg(cpu, c->reg);
+
+	switch (c->op)
+	{
+	case OP_EQ: return v == c->value;
+	case OP_NE: return v != c->value;
+	case OP_LT: return v < c->value;
+	case OP_GT: return v > c->value;
+	case OP_LE: return v <= c->value;
+	default: return v >= c->value;
+	}
+}
+
+static void format_condition(const debug_condition_t* c, char* out, size_t size)
+{
+	static const char* const names[] = { "I", "DT", "ST", "SP" };
+
+	if (c->reg < 16)
+		snprintf(out, size, "V%X %s %X", c->reg, op_names[c->op], c->value);
+	else
+		snprintf(out, size, "%s %s %X", names[c->reg - 16], op_names[c->op], c->value);
+}
+
+// Parses "<reg> <op> <hex>", e.g. "VF == 1" or "I >= 300"
+static int parse_condition(const char* s, debug_condition_t* c)
+{
+	char reg[8], op[4];
+	unsigned int value;
+
+	if (sscanf(s, "%7s %3s %x", reg, op, &value) != 3)
+		return -1;
+
+	if ((reg[0] == 'V' || reg[0] == 'v') && reg[1] && !reg[2] && strchr("0123456789abcdefABCDEF", reg[1]))
+		c->reg = (int)strtol(reg + 1, NULL, 16);
+	else if (strcmp(reg, "I") == 0 || strcmp(reg, "i") == 0)
+		c->reg = DEBUG_REG_I;
+	else if (SDL_strcasecmp(reg, "DT") == 0)
+		c->reg = DEBUG_REG_DT;
+	else if (SDL_strcasecmp(reg, "ST") == 0)
+		c->reg = DEBUG_REG_ST;
+	else if (SDL_strcasecmp(reg, "SP") == 0)
+		c->reg = DEBUG_REG_SP;
+	else
+		return -1;
+
+	for (c->op = 0; c->op < 6; c->op++)
+	{
+		if (strcmp(op, op_names[c->op]) == 0)
+			break;
+	}
+	if (c->op == 6)
+		return -1;
+
+	c->value = value;
+	return 0;
+}
+
+// Parses "<addr>" or "<lo>-<hi>", in hex
+static int parse_range(const char* s, unsigned int* lo, unsigned int* hi)
+{
+	char* end;
+
+	*lo = (unsigned int)strtoul(s, &end, 16);
+	if (end == s)
+		return -1;
+	*hi = *end == '-' ? (unsigned int)strtoul(end + 1, NULL, 16) : *lo;
+	if (*lo > *hi || *hi >= CHIP8_XO_MEM_SIZE)
+		return -1;
+	return 0;
+}
+
+static void update_view(debug_t* debug, const chip8_t* cpu, int paused)
+{
+	SDL_LockMutex(debug->lock);
+	debug->view.paused = paused;
+	debug->view.pc = cpu->pc;
+	debug->view.opcode = chip8_read(cpu, cpu->pc) << 8 | chip8_read(cpu, cpu->pc + 1);
+	debug->view.ir = cpu->ir;
+	debug->view.sp = cpu->sp;
+	memcpy(debug->view.V, cpu->V, sizeof(debug->view.V));
+	debug->view.delay_timer = cpu->delay_timer;
+	debug->view.sound_timer = cpu->sound_timer;
+	memcpy(debug->view.stack, cpu->stack, sizeof(debug->view.stack));
+	SDL_UnlockMutex(debug->lock);
+}
+
+static void print_state(const chip8_t* cpu)
+{
+	printf("PC=%04X  %04X  I=%04X  SP=%X  DT=%02X  ST=%02X\n", cpu->pc,
+		chip8_read(cpu, cpu->pc) << 8 | chip8_read(cpu, cpu->pc + 1), cpu->ir, cpu->sp, cpu->delay_timer, cpu->sound_timer);
+	for (int i = 0; i < 16; i++)
+		printf("V%X=%02X%s", i, cpu->V[i], i == 7 || i == 15 ? "\n" : " ");
+}
+
+static void list_points(const debug_t* debug)
+{
+	char text[32];
+
+	for (int i = 0; i < debug->breakpoint_count; i++)
+	{
+		const debug_breakpoint_t* b = &debug->breakpoints[i];
+		if (b->conditional)
+			format_condition(&b->condition, text, sizeof(text));
+		printf("break %04X%s%s\n", b->addr, b->conditional ? " if " : "", b->conditional ? text : "");
+	}
+
+	for (unsigned int addr = 0; addr < CHIP8_XO_MEM_SIZE; addr++)
+	{
+		if (!(debug->flags[addr] & CHIP8_DEBUG_WATCH))
+			continue;
+		unsigned int end = addr;
+		while (end + 1 < CHIP8_XO_MEM_SIZE && (debug->flags[end + 1] & CHIP8_DEBUG_WATCH))
+			end++;
+		if (end == addr)
+			printf("watch %04X\n", addr);
+		else
+			printf("watch %04X-%04X\n", addr, end);
+		addr = end;
+	}
+
+	for (int i = 0; i < debug->condition_count; i++)
+	{
+		format_condition(&debug->conditions[i], text, sizeof(text));
+		printf("cond %s\n", text);
+	}
+}
+
+static void add_breakpoint(debug_t* debug, const char* args)
+{
+	unsigned int addr, hi;
+	debug_breakpoint_t b = { 0 };
+
+	if (parse_range(args, &addr, &hi) < 0)
+	{
+		printf("Usage: break <addr> [if <reg> <op> <value>]\n");
+		return;
+	}
+	const char* cond = strstr(args, " if ");
+	if (cond)
+	{
+		if (parse_condition(cond + 4, &b.condition) < 0)
+		{
+			printf("Conditions look like V3 == 0A, I >= 300, DT != 0\n");
+			return;
+		}
+		b.conditional = 1;
+	}
+	if (debug->breakpoint_count == DEBUG_MAX_BREAKPOINTS)
+	{
+		printf("Too many breakpoints\n");
+		return;
+	}
+
+	b.addr = (uint16_t)addr;
+	debug->breakpoints[debug->breakpoint_count++] = b;
+	debug->flags[addr] |= CHIP8_DEBUG_BREAK;
+}
+
+static void delete_breakpoint(debug_t* debug, const char* args)
+{
+	unsigned int addr = (unsigned int)strtoul(args, NULL, 16) & (CHIP8_XO_MEM_SIZE - 1);
+
+	for (int i = 0; i < debug->breakpoint_count; )
+	{
+		if (debug->breakpoints[i].addr == addr)
+			debug->breakpoints[i] = debug->breakpoints[--debug->breakpoint_count];
+		else
+			i++;
+	}
+	debug->flags[addr] &= ~CHIP8_DEBUG_BREAK;
+}
+
+static void set_watch(debug_t* debug, chip8_t* cpu, const char* args, int on)
+{
+	unsigned int lo, hi;
+
+	if (parse_range(args, &lo, &hi) < 0)
+	{
+		printf("Usage: %s <addr>[-<addr>]\n", on ? "watch" : "unwatch");
+		return;
+	}
+	for (unsigned int addr = lo; addr <= hi; addr++)
+	{
+		if (on)
+			debug->flags[addr] |= CHIP8_DEBUG_WATCH;
+		else
+			debug->flags[addr] &= ~CHIP8_DEBUG_WATCH;
+	}
+	chip8_set_watch(cpu, debug->flags);
+}
+
+static void dump_memory(const chip8_t* cpu, const char* args)
+{
+	char* end;
+	unsigned int addr = (unsigned int)strtoul(args, &end, 16);
+	unsigned int count = *end ? (unsigned int)strtoul(end, NULL, 16) : 0x40;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (i % 16 == 0)
+			printf("%s%04X:", i ? "\n" : "", (addr + i) & cpu->mem_mask);
+		printf(" %02X", chip8_read(cpu, (uint16_t)(addr + i)));
+	}
+	printf("\n");
+}
+
+static void print_help(void)
+{
+	printf(
+		"c, continue           run until something stops it\n"
+		"s, step               run one instruction\n"
+		"n, next               step over a CALL\n"
+		"f, finish             run until the current subroutine returns\n"
+		"b, break <addr> [if <reg> <op> <value>]\n"
+		"d, delete <addr>      remove the breakpoints at addr\n"
+		"w, watch <addr>[-<addr>]     stop after writes to these addresses\n"
+		"unwatch <addr>[-<addr>]\n"
+		"cond <reg> <op> <value>      stop whenever this holds, e.g. cond VF == 1\n"
+		"cond clear\n"
+		"l, list               show breakpoints, watchpoints and conditions\n"
+		"r, regs               show registers\n"
+		"x <addr> [<count>]    dump memory\n"
+		"q, quit\n"
+		"Press Enter while running to break in. Numbers are hex.\n");
+}
+
+// Waits for the next line from stdin, giving up if the emulator is closed
+static int read_line(debug_t* debug, char* line)
+{
+	while (SDL_GetAtomicInt(debug->running))
+	{
+		if (SDL_WaitSemaphoreTimeout(debug->line_ready, 100))
+		{
+			memcpy(line, debug->line, DEBUG_LINE);
+			SDL_SignalSemaphore(debug->line_taken);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Runs a command. Returns 1 when the program should resume.
+static int run_command(debug_t* debug, chip8_t* cpu, char* line)
+{
+	char* newline = strchr(line, '\n');
+	if (newline)
+		*newline = '\0';
+
+	char* args = line;
+	while (*args && *args != ' ')
+		args++;
+	if (*args)
+		*args++ = '\0';
+	const char* cmd = line;
+
+	if (strcmp(cmd, "c") == 0 || strcmp(cmd, "continue") == 0)
+	{
+		debug->mode = DEBUG_RUN;
+		return 1;
+	}
+	if (strcmp(cmd, "s") == 0 || strcmp(cmd, "step") == 0 || !*cmd)
+	{
+		debug->mode = DEBUG_STEP;
+		return 1;
+	}
+	if (strcmp(cmd, "n") == 0 || strcmp(cmd, "next") == 0)
+	{
+		uint16_t opcode = chip8_read(cpu, cpu->pc) << 8 | chip8_read(cpu, cpu->pc + 1);
+		debug->mode = (opcode & 0xF000) == 0x2000 ? DEBUG_OVER : DEBUG_STEP;
+		debug->target_pc = cpu->pc + 2;
+		debug->target_sp = cpu->sp;
+		return 1;
+	}
+	if (strcmp(cmd, "f") == 0 || strcmp(cmd, "finish") == 0)
+	{
+		if (cpu->sp == 0)
+		{
+			printf("Not in a subroutine\n");
+			return 0;
+		}
+		debug->mode = DEBUG_OUT;
+		debug->target_sp = cpu->sp;
+		return 1;
+	}
+	if (strcmp(cmd, "b") == 0 || strcmp(cmd, "break") == 0)
+		add_breakpoint(debug, args);
+	else if (strcmp(cmd, "d") == 0 || strcmp(cmd, "delete") == 0)
+		delete_breakpoint(debug, args);
+	else if (strcmp(cmd, "w") == 0 || strcmp(cmd, "watch") == 0)
+		set_watch(debug, cpu, args, 1);
+	else if (strcmp(cmd, "unwatch") == 0)
+		set_watch(debug, cpu, args, 0);
+	else if (strcmp(cmd, "cond") == 0)
+	{
+		if (strcmp(args, "clear") == 0)
+			debug->condition_count = 0;
+		else if (debug->condition_count == DEBUG_MAX_CONDITIONS)
+			printf("Too many conditions\n");
+		else if (parse_condition(args, &debug->conditions[debug->condition_count]) == 0)
+			debug->condition_count++;
+		else
+			printf("Conditions look like V3 == 0A, I >= 300, DT != 0\n");
+	}
+	else if (strcmp(cmd, "l") == 0 || strcmp(cmd, "list") == 0)
+		list_points(debug);
+	else if (strcmp(cmd, "r") == 0 || strcmp(cmd, "regs") == 0)
+		print_state(cpu);
+	else if (strcmp(cmd, "x") == 0)
+		dump_memory(cpu, args);
+	else if (strcmp(cmd, "q") == 0 || strcmp(cmd, "quit") == 0)
+	{
+		SDL_SetAtomicInt(debug->running, 0);
+		return 1;
+	}
+	else
+		print_help();
+	return 0;
+}
+
+// Stops the program and takes commands until one resumes it
+static void prompt(debug_t* debug, chip8_t* cpu)
+{
+	char line[DEBUG_LINE];
+
+	debug->stop = 0;
+	update_view(debug, cpu, 1);
+	print_state(cpu);
+
+	for (;;)
+	{
+		printf("(chip8) ");
+		fflush(stdout);
+		if (!read_line(debug, line) || run_command(debug, cpu, line))
+			break;
+	}
+	update_view(debug, cpu, 0);
+}
+
+static int should_stop(debug_t* debug, const chip8_t* cpu)
+{
+	if (debug->stop)
+		return 1;
+
+	if (debug->flags[cpu->pc] & CHIP8_DEBUG_BREAK)
+	{
+		for (int i = 0; i < debug->breakpoint_count; i++)
+		{
+			const debug_breakpoint_t* b = &debug->breakpoints[i];
+			if (b->addr == cpu->pc && (!b->conditional || evaluate(&b->condition, cpu)))
+			{
+				printf("Breakpoint at %04X\n", cpu->pc);
+				return 1;
+			}
+		}
+	}
+
+	for (int i = 0; i < debug->condition_count; i++)
+	{
+		if (evaluate(&debug->conditions[i], cpu))
+		{
+			char text[32];
+			format_condition(&debug->conditions[i], text, sizeof(text));
+			printf("Condition %s holds\n", text);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int debug_init(debug_t* debug, chip8_t* cpu, SDL_AtomicInt* running)
+{
+	memset(debug, 0, sizeof(*debug));
+	debug->running = running;
+	debug->stop = 1; // start paused so breakpoints can be set first
+
+	debug->line_ready = SDL_CreateSemaphore(0);
+	debug->line_taken = SDL_CreateSemaphore(0);
+	debug->lock = SDL_CreateMutex();
+	if (!debug->line_ready || !debug->line_taken || !debug->lock)
+	{
+		printf("Debugger Error: %s\n", SDL_GetError());
+		return -1;
+	}
+
+	// Never joined: it spends its life blocked in fgets()
+	SDL_Thread* thread = SDL_CreateThread(stdin_thread, "chip8 debugger input", debug);
+	if (!thread)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		return -1;
+	}
+	SDL_DetachThread(thread);
+
+	chip8_set_watch(cpu, debug->flags);
+	update_view(debug, cpu, 1);
+	printf("Debugger ready, type help for commands\n");
+	return 1;
+}
+
+// The debugging counterpart of the frontend's frame loop: checks for
+// breakpoints, conditions and step targets around each instruction
+void debug_run_frame(debug_t* debug, chip8_t* cpu, int cycles_per_frame, int idle_pc, trace_t* trace)
+{
+	char line[DEBUG_LINE];
+
+	// Any line typed while running breaks in, and is then run as a command
+	if (SDL_TryWaitSemaphore(debug->line_ready))
+	{
+		memcpy(line, debug->line, DEBUG_LINE);
+		SDL_SignalSemaphore(debug->line_taken);
+		update_view(debug, cpu, 1);
+		print_state(cpu);
+		if (!run_command(debug, cpu, line))
+			debug->stop = 1;
+	}
+
+	for (int i = 0; i < cycles_per_frame && SDL_GetAtomicInt(debug->running); i++)
+	{
+		if (should_stop(debug, cpu))
+			prompt(debug, cpu);
+		if (!SDL_GetAtomicInt(debug->running))
+			break;
+
+		if (trace)
+			trace_step(trace, cpu);
+		else
+			emulate_cycle(cpu);
+
+		if (cpu->watch_hit)
+		{
+			printf("Write to %04X\n", cpu->watch_addr);
+			cpu->watch_hit = 0;
+			debug->stop = 1;
+		}
+
+		switch (debug->mode)
+		{
+		case DEBUG_STEP:
+			debug->stop = 1;
+			break;
+		case DEBUG_OVER:
+			debug->stop |= cpu->pc == debug->target_pc && cpu->sp == debug->target_sp;
+			break;
+		case DEBUG_OUT:
+			debug->stop |= cpu->sp < debug->target_sp;
+			break;
+		default:
+			break;
+		}
+		if (debug->stop)
+			debug->mode = DEBUG_RUN;
+
+		if (cpu->pc == idle_pc)
+			break;
+	}
+
+	update_view(debug, cpu, debug->stop);
+}
+
+// Draws the registers and stack over the top-left corner of the window
+void debug_draw_overlay(debug_t* debug, SDL_Renderer* renderer)
+{
+	debug_view_t view;
+	SDL_LockMutex(debug->lock);
+	view = debug->view;
+	SDL_UnlockMutex(debug->lock);
+
+	float line = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+	float y = 4;
+
+	SDL_SetRenderDrawColor(renderer, 0x40, 0xFF, 0x40, 0xFF);
+	SDL_RenderDebugTextFormat(renderer, 4, y, "%s PC=%04X %04X I=%04X SP=%X DT=%02X ST=%02X",
+		view.paused ? "PAUSED " : "RUNNING", view.pc, view.opcode, view.ir, view.sp, view.delay_timer, view.sound_timer);
+	for (int row = 0; row < 2; row++)
+	{
+		const uint8_t* v = &view.V[row * 8];
+		y += line;
+		SDL_RenderDebugTextFormat(renderer, 4, y, "V%X-V%X %02X %02X %02X %02X %02X %02X %02X %02X",
+			row * 8, row * 8 + 7, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+	}
+	// sp comes straight from the CPU, so don't trust it to index the snapshot
+	int depth = view.sp < 16 ? view.sp : 16;
+	for (int i = depth - 1; i >= 0 && i >= depth - 4; i--)
+	{
+		y += line;
+		SDL_RenderDebugTextFormat(renderer, 4, y, "stack %X: %04X", i, view.stack[i]);
+	}
+}
+
+void debug_quit(debug_t* debug, chip8_t* cpu)
+{
+	chip8_set_watch(cpu, NULL);
+	SDL_DestroyMutex(debug->lock);
+	// The semaphores stay alive for the detached stdin thread
+}
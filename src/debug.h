@@ -0,0 +1,79 @@
+#ifndef _DEBUG_H
+#define _DEBUG_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "trace.h"
+
+#define DEBUG_MAX_BREAKPOINTS 64
+#define DEBUG_MAX_CONDITIONS 16
+#define DEBUG_LINE 256
+
+#define DEBUG_REG_I 16
+#define DEBUG_REG_DT 17
+#define DEBUG_REG_ST 18
+#define DEBUG_REG_SP 19
+
+typedef enum {
+	DEBUG_RUN,
+	DEBUG_STEP, // stop before the next instruction
+	DEBUG_OVER, // stop when the current subroutine level reaches target_pc
+	DEBUG_OUT, // stop once the current subroutine returns
+} debug_mode_t;
+
+// A register comparison like "V3 == 0A" or "I >= 300"
+typedef struct {
+	int reg; // 0-15 for V0-VF, then DEBUG_REG_*
+	int op;
+	unsigned int value;
+} debug_condition_t;
+
+typedef struct {
+	uint16_t addr;
+	int conditional; // bool
+	debug_condition_t condition;
+} debug_breakpoint_t;
+
+// What the overlay shows, copied out of the emulation thread
+typedef struct {
+	int paused; // bool
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t ir;
+	uint16_t sp;
+	uint8_t V[16];
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	uint16_t stack[16];
+} debug_view_t;
+
+// The debugger runs in the emulation thread and takes its commands from
+// stdin. Breakpoints and watchpoints live in a per-address flag table: the
+// debug loop checks the flag of each PC before running it, and watched
+// pages are trapped in the core's write barrier, so the normal interpreter
+// loop never looks at any of it.
+typedef struct {
+	uint8_t flags[CHIP8_XO_MEM_SIZE]; // CHIP8_DEBUG_* per address
+	debug_breakpoint_t breakpoints[DEBUG_MAX_BREAKPOINTS];
+	int breakpoint_count;
+	debug_condition_t conditions[DEBUG_MAX_CONDITIONS]; // checked before every instruction
+	int condition_count;
+	debug_mode_t mode;
+	uint16_t target_pc;
+	uint16_t target_sp;
+	int stop; // bool: prompt before the next instruction
+	SDL_AtomicInt* running; // cleared by the quit command
+
+	// stdin is read on its own thread so a pending prompt never blocks shutdown
+	SDL_Semaphore* line_ready;
+	SDL_Semaphore* line_taken;
+	char line[DEBUG_LINE];
+
+	SDL_Mutex* lock;
+	debug_view_t view; // under lock
+} debug_t;
+
+int debug_init(debug_t* debug, chip8_t* cpu, SDL_AtomicInt* running);
+void debug_run_frame(debug_t* debug, chip8_t* cpu, int cycles_per_frame, int idle_pc, trace_t* trace);
+void debug_draw_overlay(debug_t* debug, SDL_Renderer* renderer);
+void debug_quit(debug_t* debug, chip8_t* cpu);
+#endif
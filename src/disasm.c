@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disasm.h"
+
+// Writes the mnemonic for the instruction at code (Cowgod's syntax, plus
+// the usual SUPER-CHIP and XO-CHIP extensions) and returns its size in
+// bytes. Anything the platform doesn't define comes out as a DW.
+int chip8_disassemble(const uint8_t* code, size_t avail, chip8_platform_t platform, char* out, size_t size)
+{
+	if (avail < 2)
+	{
+		snprintf(out, size, "DB %02X", code[0]);
+		return 1;
+	}
+
+	uint16_t opcode = code[0] << 8 | code[1];
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int n = opcode & 0x000F;
+	int nn = opcode & 0x00FF;
+	int nnn = opcode & 0x0FFF;
+	int schip = platform != CHIP8_PLATFORM_CHIP8;
+	int xo = platform == CHIP8_PLATFORM_XOCHIP;
+
+	switch (opcode & 0xF000)
+	{
+		case 0x0000:
+			if (opcode == 0x00E0)
+				snprintf(out, size, "CLS");
+			else if (opcode == 0x00EE)
+				snprintf(out, size, "RET");
+			else if (opcode == 0x00FB && schip)
+				snprintf(out, size, "SCR");
+			else if (opcode == 0x00FC && schip)
+				snprintf(out, size, "SCL");
+			else if (opcode == 0x00FD && schip)
+				snprintf(out, size, "EXIT");
+			else if (opcode == 0x00FE && schip)
+				snprintf(out, size, "LOW");
+			else if (opcode == 0x00FF && schip)
+				snprintf(out, size, "HIGH");
+			else if ((opcode & 0xFFF0) == 0x00C0 && schip)
+				snprintf(out, size, "SCD %X", n);
+			else if ((opcode & 0xFFF0) == 0x00D0 && xo)
+				snprintf(out, size, "SCU %X", n);
+			else
+				break;
+			return 2;
+		case 0x1000:
+			snprintf(out, size, "JP %03X", nnn);
+			return 2;
+		case 0x2000:
+			snprintf(out, size, "CALL %03X", nnn);
+			return 2;
+		case 0x3000:
+			snprintf(out, size, "SE V%X, %02X", x, nn);
+			return 2;
+		case 0x4000:
+			snprintf(out, size, "SNE V%X, %02X", x, nn);
+			return 2;
+		case 0x5000:
+			if (n == 0)
+				snprintf(out, size, "SE V%X, V%X", x, y);
+			else if (n == 2 && xo)
+				snprintf(out, size, "SAVE V%X-V%X", x, y);
+			else if (n == 3 && xo)
+				snprintf(out, size, "LOAD V%X-V%X", x, y);
+			else
+				break;
+			return 2;
+		case 0x6000:
+			snprintf(out, size, "LD V%X, %02X", x, nn);
+			return 2;
+		case 0x7000:
+			snprintf(out, size, "ADD V%X, %02X", x, nn);
+			return 2;
+		case 0x8000:
+		{
+			static const char* const ops[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL };
+			if (!ops[n])
+				break;
+			snprintf(out, size, "%s V%X, V%X", ops[n], x, y);
+			return 2;
+		}
+		case 0x9000:
+			if (n != 0)
+				break;
+			snprintf(out, size, "SNE V%X, V%X", x, y);
+			return 2;
+		case 0xA000:
+			snprintf(out, size, "LD I, %03X", nnn);
+			return 2;
+		case 0xB000:
+			snprintf(out, size, "JP V0, %03X", nnn);
+			return 2;
+		case 0xC000:
+			snprintf(out, size, "RND V%X, %02X", x, nn);
+			return 2;
+		case 0xD000:
+			snprintf(out, size, "DRW V%X, V%X, %X", x, y, n);
+			return 2;
+		case 0xE000:
+			if (nn == 0x9E)
+				snprintf(out, size, "SKP V%X", x);
+			else if (nn == 0xA1)
+				snprintf(out, size, "SKNP V%X", x);
+			else
+				break;
+			return 2;
+		case 0xF000:
+			if (opcode == 0xF000 && xo)
+			{
+				if (avail < 4)
+					break;
+				snprintf(out, size, "LD I, long %04X", code[2] << 8 | code[3]);
+				return 4;
+			}
+			switch (nn)
+			{
+				case 0x01: if (!xo) goto unknown; snprintf(out, size, "PLANE %X", x); return 2;
+				case 0x02: if (!xo || x) goto unknown; snprintf(out, size, "AUDIO"); return 2;
+				case 0x07: snprintf(out, size, "LD V%X, DT", x); return 2;
+				case 0x0A: snprintf(out, size, "LD V%X, K", x); return 2;
+				case 0x15: snprintf(out, size, "LD DT, V%X", x); return 2;
+				case 0x18: snprintf(out, size, "LD ST, V%X", x); return 2;
+				case 0x1E: snprintf(out, size, "ADD I, V%X", x); return 2;
+				case 0x29: snprintf(out, size, "LD F, V%X", x); return 2;
+				case 0x30: if (!schip) goto unknown; snprintf(out, size, "LD HF, V%X", x); return 2;
+				case 0x33: snprintf(out, size, "LD B, V%X", x); return 2;
+				case 0x3A: if (!xo) goto unknown; snprintf(out, size, "PITCH V%X", x); return 2;
+				case 0x55: snprintf(out, size, "LD [I], V%X", x); return 2;
+				case 0x65: snprintf(out, size, "LD V%X, [I]", x); return 2;
+				case 0x75: if (!schip) goto unknown; snprintf(out, size, "LD R, V%X", x); return 2;
+				case 0x85: if (!schip) goto unknown; snprintf(out, size, "LD V%X, R", x); return 2;
+			}
+			break;
+	}
+
+unknown:
+	snprintf(out, size, "DW %04X", opcode);
+	return 2;
+}
+
+static int is_skip(uint16_t opcode)
+{
+	switch (opcode & 0xF000)
+	{
+		case 0x3000:
+		case 0x4000:
+			return 1;
+		case 0x5000:
+		case 0x9000:
+			return (opcode & 0x000F) == 0;
+		case 0xE000:
+			return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1;
+	}
+	return 0;
+}
+
+static uint16_t read16(const uint8_t* image, size_t size, size_t addr)
+{
+	return addr + 1 < size ? image[addr] << 8 | image[addr + 1] : 0;
+}
+
+static int instruction_size(const uint8_t* image, size_t size, size_t addr, chip8_platform_t platform)
+{
+	return platform == CHIP8_PLATFORM_XOCHIP && read16(image, size, addr) == 0xF000 ? 4 : 2;
+}
+
+static void mark_data(chip8_cfg_t* cfg, size_t addr, size_t len)
+{
+	for (size_t i = 0; i < len && addr + i < cfg->size; i++)
+		cfg->flags[addr + i] |= CHIP8_ADDR_DATA;
+}
+
+typedef struct {
+	uint16_t* items;
+	size_t count;
+} worklist_t;
+
+// Marks addr as the start of a block and queues it unless it has already
+// been explored or queued, so the worklist never holds more than one entry
+// per address
+static void push(chip8_cfg_t* cfg, worklist_t* work, size_t addr, uint8_t flag)
+{
+	if (addr + 1 >= cfg->size)
+		return;
+	if (!(cfg->flags[addr] & (CHIP8_ADDR_CODE | CHIP8_ADDR_LEADER)))
+		work->items[work->count++] = (uint16_t)addr;
+	cfg->flags[addr] |= flag | CHIP8_ADDR_LEADER;
+}
+
+// Follows one path of execution from addr until it ends or meets code that
+// has already been explored, queueing every other path it finds
+static void explore(chip8_cfg_t* cfg, worklist_t* work, const uint8_t* image, size_t addr)
+{
+	long ir = -1; // value of I when it's a known constant
+
+	while (addr + 1 < cfg->size && !(cfg->flags[addr] & (CHIP8_ADDR_CODE | CHIP8_ADDR_BODY)))
+	{
+		uint16_t opcode = read16(image, cfg->size, addr);
+		int len = instruction_size(image, cfg->size, addr, cfg->platform);
+		int x = (opcode & 0x0F00) >> 8;
+		size_t next = addr + len;
+
+		cfg->flags[addr] |= CHIP8_ADDR_CODE;
+		for (int i = 1; i < len && addr + i < cfg->size; i++)
+			cfg->flags[addr + i] |= CHIP8_ADDR_BODY;
+
+		if (opcode == 0x00EE || (opcode == 0x00FD && cfg->platform != CHIP8_PLATFORM_CHIP8))
+			return;
+
+		switch (opcode & 0xF000)
+		{
+			case 0x1000:
+				push(cfg, work, opcode & 0x0FFF, CHIP8_ADDR_JUMP);
+				return;
+			case 0x2000:
+				push(cfg, work, opcode & 0x0FFF, CHIP8_ADDR_CALL);
+				push(cfg, work, next, 0);
+				ir = -1; // the subroutine may change I
+				break;
+			case 0xA000:
+				ir = opcode & 0x0FFF;
+				if ((size_t)ir < cfg->size)
+					cfg->flags[ir] |= CHIP8_ADDR_REF;
+				break;
+			case 0xB000:
+				// A jump table: at least its first entry is code
+				push(cfg, work, opcode & 0x0FFF, CHIP8_ADDR_JUMP);
+				return;
+			case 0xD000:
+				if (ir >= 0)
+				{
+					int rows = opcode & 0x000F;
+					size_t bytes = rows == 0 && cfg->platform != CHIP8_PLATFORM_CHIP8 ? 32 : rows;
+					mark_data(cfg, ir, bytes);
+				}
+				break;
+			case 0xF000:
+				if (len == 4)
+				{
+					ir = read16(image, cfg->size, addr + 2);
+					if ((size_t)ir < cfg->size)
+						cfg->flags[ir] |= CHIP8_ADDR_REF;
+					else
+						ir = -1;
+				}
+				else if ((opcode & 0x00FF) == 0x1E || (opcode & 0x00FF) == 0x29 || (opcode & 0x00FF) == 0x30)
+					ir = -1;
+				else if (ir >= 0 && ((opcode & 0x00FF) == 0x55 || (opcode & 0x00FF) == 0x65))
+					mark_data(cfg, ir, x + 1);
+				else if (ir >= 0 && (opcode & 0x00FF) == 0x33)
+					mark_data(cfg, ir, 3);
+				else if (ir >= 0 && opcode == 0xF002)
+					mark_data(cfg, ir, 16);
+				break;
+		}
+
+		if (is_skip(opcode))
+		{
+			// Both the skipped instruction and the one after it start blocks
+			push(cfg, work, next, CHIP8_ADDR_JUMP);
+			push(cfg, work, next + instruction_size(image, cfg->size, next, cfg->platform), CHIP8_ADDR_JUMP);
+			return;
+		}
+
+		addr = next;
+	}
+}
+
+static int add_block(chip8_cfg_t* cfg, int* capacity, const chip8_block_t* block)
+{
+	if (cfg->block_count == *capacity)
+	{
+		int grown = *capacity ? *capacity * 2 : 64;
+		chip8_block_t* blocks = realloc(cfg->blocks, grown * sizeof(chip8_block_t));
+		if (!blocks)
+			return -1;
+		cfg->blocks = blocks;
+		*capacity = grown;
+	}
+	cfg->blocks[cfg->block_count++] = *block;
+	return 0;
+}
+
+// Cuts the explored code into basic blocks, in address order
+static int form_blocks(chip8_cfg_t* cfg, const uint8_t* image)
+{
+	int capacity = 0;
+
+	for (size_t addr = 0; addr < cfg->size; addr++)
+	{
+		if (!(cfg->flags[addr] & CHIP8_ADDR_CODE))
+			continue;
+
+		chip8_block_t block = { 0 };
+		block.start = (uint16_t)addr;
+
+		for (;;)
+		{
+			uint16_t opcode = read16(image, cfg->size, addr);
+			size_t next = addr + instruction_size(image, cfg->size, addr, cfg->platform);
+			block.last = (uint16_t)addr;
+			block.kind = CHIP8_END_FALL;
+
+			if (opcode == 0x00EE)
+				block.kind = CHIP8_END_RET;
+			else if (opcode == 0x00FD && cfg->platform != CHIP8_PLATFORM_CHIP8)
+				block.kind = CHIP8_END_EXIT;
+			else if ((opcode & 0xF000) == 0x1000)
+				block.kind = (opcode & 0x0FFF) == addr ? CHIP8_END_HALT : CHIP8_END_JUMP;
+			else if ((opcode & 0xF000) == 0x2000)
+				block.kind = CHIP8_END_CALL;
+			else if ((opcode & 0xF000) == 0xB000)
+				block.kind = CHIP8_END_INDIRECT;
+			else if (is_skip(opcode))
+				block.kind = CHIP8_END_SKIP;
+
+			addr = next;
+			if (block.kind != CHIP8_END_FALL || addr >= cfg->size || (cfg->flags[addr] & (CHIP8_ADDR_LEADER | CHIP8_ADDR_CODE)) != CHIP8_ADDR_CODE)
+				break;
+		}
+		block.end = (uint32_t)addr;
+
+		int falls = block.kind == CHIP8_END_FALL || block.kind == CHIP8_END_CALL || block.kind == CHIP8_END_SKIP;
+		if (falls && addr < cfg->size && (cfg->flags[addr] & CHIP8_ADDR_CODE))
+			block.succ[block.succ_count++] = (uint16_t)addr;
+
+		uint16_t opcode = read16(image, cfg->size, block.last);
+		if (block.kind == CHIP8_END_JUMP || block.kind == CHIP8_END_HALT || block.kind == CHIP8_END_CALL || block.kind == CHIP8_END_INDIRECT)
+			block.succ[block.succ_count++] = opcode & 0x0FFF;
+		else if (block.kind == CHIP8_END_SKIP)
+			block.succ[block.succ_count++] = (uint16_t)(addr + instruction_size(image, cfg->size, addr, cfg->platform));
+
+		if (add_block(cfg, &capacity, &block) < 0)
+			return -1;
+		addr--; // the loop's increment lands on the next block
+	}
+	return 0;
+}
+
+// Analyses size bytes of address space holding a loaded program, starting
+// from entry (normally CHIP8_PROG_START). Data is recognised from how the
+// reachable code uses I: sprites drawn, registers saved or loaded, BCD
+// results and audio patterns.
+int chip8_cfg_build(chip8_cfg_t* cfg, const uint8_t* image, size_t size, uint16_t entry, chip8_platform_t platform)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->platform = platform;
+	cfg->size = size;
+	cfg->flags = calloc(size, 1);
+	worklist_t work = { malloc(size * sizeof(uint16_t)), 0 };
+	if (!cfg->flags || !work.items)
+	{
+		printf("Could not allocate analysis tables\n");
+		free(work.items);
+		chip8_cfg_free(cfg);
+		return -1;
+	}
+
+	push(cfg, &work, entry, CHIP8_ADDR_JUMP);
+	while (work.count)
+	{
+		size_t addr = work.items[--work.count];
+		explore(cfg, &work, image, addr);
+	}
+	free(work.items);
+
+	if (form_blocks(cfg, image) < 0)
+	{
+		printf("Could not allocate basic blocks\n");
+		chip8_cfg_free(cfg);
+		return -1;
+	}
+	return 1;
+}
+
+// Returns the block containing addr, or NULL if addr isn't reachable code
+const chip8_block_t* chip8_cfg_find(const chip8_cfg_t* cfg, uint16_t addr)
+{
+	int lo = 0;
+	int hi = cfg->block_count - 1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		const chip8_block_t* block = &cfg->blocks[mid];
+		if (addr < block->start)
+			hi = mid - 1;
+		else if (addr >= block->end)
+			lo = mid + 1;
+		else
+			return block;
+	}
+	return NULL;
+}
+
+void chip8_cfg_free(chip8_cfg_t* cfg)
+{
+	free(cfg->flags);
+	free(cfg->blocks);
+	cfg->flags = NULL;
+	cfg->blocks = NULL;
+	cfg->block_count = 0;
+}
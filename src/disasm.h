@@ -0,0 +1,53 @@
+#ifndef _DISASM_H
+#define _DISASM_H
+#include <stddef.h>
+#include <stdint.h>
+#include "cpu.h"
+
+#define CHIP8_DISASM_MAX 32 // longest line chip8_disassemble() writes, with the terminator
+
+// Per-address analysis flags
+#define CHIP8_ADDR_CODE   0x01 // an instruction starts here
+#define CHIP8_ADDR_BODY   0x02 // inside an instruction, after its first byte
+#define CHIP8_ADDR_DATA   0x04 // read by the program (sprites, tables, saved registers)
+#define CHIP8_ADDR_LEADER 0x08 // a basic block starts here
+#define CHIP8_ADDR_CALL   0x10 // the target of a CALL
+#define CHIP8_ADDR_JUMP   0x20 // the target of a jump or skip
+#define CHIP8_ADDR_REF    0x40 // loaded into I by ANNN or F000 NNNN
+
+// How a basic block ends
+typedef enum {
+	CHIP8_END_FALL, // runs into the next block
+	CHIP8_END_JUMP, // 1NNN
+	CHIP8_END_CALL, // 2NNN, returns to the next block
+	CHIP8_END_SKIP, // conditional skip over the next instruction
+	CHIP8_END_RET, // 00EE
+	CHIP8_END_EXIT, // 00FD
+	CHIP8_END_INDIRECT, // BNNN, target only known at run time
+	CHIP8_END_HALT, // jumps to itself, the usual end-of-program idle loop
+} chip8_block_end_t;
+
+typedef struct {
+	uint16_t start;
+	uint32_t end; // one past the last byte
+	uint16_t last; // address of the final instruction
+	chip8_block_end_t kind;
+	uint16_t succ[2]; // successors: the next block, then the jump, call or skip target
+	int succ_count;
+} chip8_block_t;
+
+// Static analysis of a memory image: which bytes are reachable code, which
+// are data, and the basic blocks of the control-flow graph in address order
+typedef struct {
+	chip8_platform_t platform;
+	size_t size; // bytes of address space analysed
+	uint8_t* flags; // CHIP8_ADDR_* per address
+	chip8_block_t* blocks;
+	int block_count;
+} chip8_cfg_t;
+
+int chip8_disassemble(const uint8_t* code, size_t avail, chip8_platform_t platform, char* out, size_t size);
+int chip8_cfg_build(chip8_cfg_t* cfg, const uint8_t* image, size_t size, uint16_t entry, chip8_platform_t platform);
+const chip8_block_t* chip8_cfg_find(const chip8_cfg_t* cfg, uint16_t addr);
+void chip8_cfg_free(chip8_cfg_t* cfg);
+#endif
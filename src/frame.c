@@ -0,0 +1,70 @@
+#include <string.h>
+#include "frame.h"
+
+#define FRAME_FRESH 4
+
+void frame_buffer_init(frame_buffer_t* frames)
+{
+	memset(frames->slots, 0, sizeof(frames->slots));
+	memset(frames->since, 0, sizeof(frames->since));
+	frames->back = 0;
+	SDL_SetAtomicInt(&frames->middle, 1);
+	frames->front = 2;
+}
+
+frame_t* frame_buffer_back(frame_buffer_t* frames)
+{
+	return &frames->slots[frames->back];
+}
+
+// Copies the CPU's display into the back slot and hands it to the consumer,
+// taking the old middle slot in exchange. An unconsumed frame in the middle
+// is simply replaced.
+//
+// Dirty rows are tracked per slot: since[n] collects every row the CPU has
+// changed since the frame now sitting in slot n was produced. That makes the
+// copy incremental (the back slot only needs since[back] refreshed) and
+// lets each published frame say exactly which rows differ from whatever
+// frame the consumer is holding, even when the consumer skipped frames.
+void frame_buffer_publish(frame_buffer_t* frames, chip8_t* cpu)
+{
+	uint64_t dirty = chip8_get_dirty(cpu);
+	chip8_clear_dirty(cpu);
+	for (int i = 0; i < 3; i++)
+		frames->since[i] |= dirty;
+
+	frame_t* frame = &frames->slots[frames->back];
+	uint64_t stale = frames->since[frames->back];
+	for (int row = 0; row < CHIP8_HIRES_HEIGHT; row++)
+	{
+		if (!((stale >> row) & 1))
+			continue;
+		for (int p = 0; p < CHIP8_PLANES; p++)
+		{
+			frame->display[p][row][0] = cpu->display[p][row][0];
+			frame->display[p][row][1] = cpu->display[p][row][1];
+		}
+	}
+	frame->width = chip8_get_width(cpu);
+	frame->height = chip8_get_height(cpu);
+	memcpy(frame->changed, frames->since, sizeof(frame->changed));
+	frames->since[frames->back] = 0;
+
+	int old = SDL_SetAtomicInt(&frames->middle, frames->back | FRAME_FRESH);
+	frames->back = old & 3;
+}
+
+// Returns the newest published frame, or NULL if nothing was published
+// since the last call. changed receives the rows that differ from the
+// previously acquired frame.
+const frame_t* frame_buffer_acquire(frame_buffer_t* frames, uint64_t* changed)
+{
+	if (!(SDL_GetAtomicInt(&frames->middle) & FRAME_FRESH))
+		return NULL;
+
+	int old = SDL_SetAtomicInt(&frames->middle, frames->front);
+	const frame_t* frame = &frames->slots[old & 3];
+	*changed = frame->changed[frames->front];
+	frames->front = old & 3;
+	return frame;
+}
@@ -0,0 +1,30 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+
+// A snapshot of everything needed to present one emulated frame
+typedef struct {
+	uint64_t display[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	int width;
+	int height;
+	uint64_t changed[3]; // rows that differ from the frame currently held in slot n
+} frame_t;
+
+// Lock-free triple buffer between one producer (the emulation thread) and
+// one consumer (the render thread). The producer always owns a back slot
+// and the consumer a front slot; publishing or acquiring is a single atomic
+// exchange with the shared middle slot, so neither side ever waits.
+typedef struct {
+	frame_t slots[3];
+	SDL_AtomicInt middle; // slot index, plus FRAME_FRESH until the consumer takes it
+	int back; // producer only
+	int front; // consumer only
+	uint64_t since[3]; // producer only: rows changed since slot n's frame was produced
+} frame_buffer_t;
+
+void frame_buffer_init(frame_buffer_t* frames);
+frame_t* frame_buffer_back(frame_buffer_t* frames);
+void frame_buffer_publish(frame_buffer_t* frames, chip8_t* cpu);
+const frame_t* frame_buffer_acquire(frame_buffer_t* frames, uint64_t* changed);
+#endif
@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <string.h>
+#include "gpu.h"
+
+// Uniforms shared by both fragment shaders
+typedef struct {
+	float palette[4][4];
+	float effect[4]; // phosphor decay this present, scanlines, display width, display height
+} gpu_params_t;
+
+// The shaders, in GLSL for reference (set 2 holds fragment samplers and set
+// 3 fragment uniforms, per SDL's SPIR-V conventions):
+//
+//   // fullscreen.vert: one triangle covering the viewport
+//   layout(location = 0) out vec2 uv;
+//   void main() {
+//       uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+//       gl_Position = vec4(uv * vec2(2, -2) + vec2(-1, 1), 0, 1);
+//   }
+//
+//   layout(set = 3, binding = 0) uniform Params { vec4 palette[4]; vec4 effect; };
+//
+//   // persist.frag, drawn at native size
+//   layout(set = 2, binding = 0) uniform usampler2D display;
+//   layout(set = 2, binding = 1) uniform sampler2D previous;
+//   layout(location = 0) out vec4 color;
+//   void main() {
+//       ivec2 p = ivec2(gl_FragCoord.xy);
+//       uint word = uint(p.x) >> 5, bit = 31 - (uint(p.x) & 31);
+//       uint b0 = (texelFetch(display, ivec2(0, p.y), 0)[word] >> bit) & 1;
+//       uint b1 = (texelFetch(display, ivec2(1, p.y), 0)[word] >> bit) & 1;
+//       color = max(palette[b0 | b1 << 1], texelFetch(previous, p, 0) * effect.x);
+//   }
+//
+//   // output.frag, drawn over the window's display rectangle
+//   layout(set = 2, binding = 0) uniform sampler2D image;
+//   layout(location = 0) in vec2 uv;
+//   layout(location = 0) out vec4 color;
+//   void main() {
+//       vec2 source = uv * effect.zw;
+//       float shade = 1 - effect.y * abs(fract(source.y) * 2 - 1);
+//       color = texelFetch(image, ivec2(source), 0) * shade;
+//   }
+//
+// There's no shader compiler in the build, so the SPIR-V below is that code
+// assembled by hand, and the MSL is a straight translation.
+
+static const Uint32 fullscreen_spirv[] = {
+	0x07230203, 0x00010000, 0x00000000, 0x00000021, 0x00000000, 0x00020011, 0x00000001, 0x0006000b,
+	0x00000001, 0x4c534c47, 0x6474732e, 0x3035342e, 0x00000000, 0x0003000e, 0x00000000, 0x00000001,
+	0x0008000f, 0x00000000, 0x00000002, 0x6e69616d, 0x00000000, 0x00000011, 0x00000012, 0x00000013,
+	0x00040047, 0x00000011, 0x0000000b, 0x0000002a, 0x00040047, 0x00000012, 0x0000001e, 0x00000000,
+	0x00040047, 0x00000013, 0x0000000b, 0x00000000, 0x00020013, 0x00000003, 0x00030021, 0x00000004,
+	0x00000003, 0x00040015, 0x00000005, 0x00000020, 0x00000001, 0x00030016, 0x00000006, 0x00000020,
+	0x00040017, 0x00000007, 0x00000006, 0x00000002, 0x00040017, 0x00000008, 0x00000006, 0x00000004,
+	0x00040020, 0x00000009, 0x00000001, 0x00000005, 0x00040020, 0x0000000a, 0x00000003, 0x00000007,
+	0x00040020, 0x0000000b, 0x00000003, 0x00000008, 0x0004002b, 0x00000005, 0x0000000c, 0x00000001,
+	0x0004002b, 0x00000005, 0x0000000d, 0x00000002, 0x0004002b, 0x00000006, 0x0000000e, 0x00000000,
+	0x0004002b, 0x00000006, 0x0000000f, 0x3f800000, 0x0004002b, 0x00000006, 0x00000010, 0x40000000,
+	0x0004003b, 0x00000009, 0x00000011, 0x00000001, 0x0004003b, 0x0000000a, 0x00000012, 0x00000003,
+	0x0004003b, 0x0000000b, 0x00000013, 0x00000003, 0x00050036, 0x00000003, 0x00000002, 0x00000000,
+	0x00000004, 0x000200f8, 0x00000014, 0x0004003d, 0x00000005, 0x00000015, 0x00000011, 0x000500c4,
+	0x00000005, 0x00000016, 0x00000015, 0x0000000c, 0x000500c7, 0x00000005, 0x00000017, 0x00000016,
+	0x0000000d, 0x000500c7, 0x00000005, 0x00000018, 0x00000015, 0x0000000d, 0x0004006f, 0x00000006,
+	0x00000019, 0x00000017, 0x0004006f, 0x00000006, 0x0000001a, 0x00000018, 0x00050050, 0x00000007,
+	0x0000001b, 0x00000019, 0x0000001a, 0x0003003e, 0x00000012, 0x0000001b, 0x00050085, 0x00000006,
+	0x0000001c, 0x00000019, 0x00000010, 0x00050083, 0x00000006, 0x0000001d, 0x0000001c, 0x0000000f,
+	0x00050085, 0x00000006, 0x0000001e, 0x0000001a, 0x00000010, 0x00050083, 0x00000006, 0x0000001f,
+	0x0000000f, 0x0000001e, 0x00070050, 0x00000008, 0x00000020, 0x0000001d, 0x0000001f, 0x0000000e,
+	0x0000000f, 0x0003003e, 0x00000013, 0x00000020, 0x000100fd, 0x00010038,
+};
+
+static const Uint32 persist_spirv[] = {
+	0x07230203, 0x00010000, 0x00000000, 0x00000046, 0x00000000, 0x00020011, 0x00000001, 0x0006000b,
+	0x00000001, 0x4c534c47, 0x6474732e, 0x3035342e, 0x00000000, 0x0003000e, 0x00000000, 0x00000001,
+	0x0007000f, 0x00000004, 0x00000002, 0x6e69616d, 0x00000000, 0x0000001e, 0x00000022, 0x00030010,
+	0x00000002, 0x00000007, 0x00040047, 0x00000010, 0x00000006, 0x00000010, 0x00030047, 0x00000011,
+	0x00000002, 0x00050048, 0x00000011, 0x00000000, 0x00000023, 0x00000000, 0x00050048, 0x00000011,
+	0x00000001, 0x00000023, 0x00000040, 0x00040047, 0x0000001e, 0x0000000b, 0x0000000f, 0x00040047,
+	0x0000001f, 0x00000022, 0x00000002, 0x00040047, 0x0000001f, 0x00000021, 0x00000000, 0x00040047,
+	0x00000020, 0x00000022, 0x00000002, 0x00040047, 0x00000020, 0x00000021, 0x00000001, 0x00040047,
+	0x00000021, 0x00000022, 0x00000003, 0x00040047, 0x00000021, 0x00000021, 0x00000000, 0x00040047,
+	0x00000022, 0x0000001e, 0x00000000, 0x00020013, 0x00000003, 0x00030021, 0x00000004, 0x00000003,
+	0x00040015, 0x00000005, 0x00000020, 0x00000001, 0x00040015, 0x00000006, 0x00000020, 0x00000000,
+	0x00030016, 0x00000007, 0x00000020, 0x00040017, 0x00000008, 0x00000007, 0x00000002, 0x00040017,
+	0x00000009, 0x00000007, 0x00000004, 0x00040017, 0x0000000a, 0x00000005, 0x00000002, 0x00040017,
+	0x0000000b, 0x00000006, 0x00000004, 0x00090019, 0x0000000c, 0x00000007, 0x00000001, 0x00000000,
+	0x00000000, 0x00000000, 0x00000001, 0x00000000, 0x0003001b, 0x0000000d, 0x0000000c, 0x00040020,
+	0x0000000e, 0x00000000, 0x0000000d, 0x0004002b, 0x00000006, 0x0000000f, 0x00000004, 0x0004001c,
+	0x00000010, 0x00000009, 0x0000000f, 0x0004001e, 0x00000011, 0x00000010, 0x00000009, 0x00040020,
+	0x00000012, 0x00000002, 0x00000011, 0x00040020, 0x00000013, 0x00000002, 0x00000009, 0x00040020,
+	0x00000014, 0x00000003, 0x00000009, 0x00090019, 0x00000015, 0x00000006, 0x00000001, 0x00000000,
+	0x00000000, 0x00000000, 0x00000001, 0x00000000, 0x0003001b, 0x00000016, 0x00000015, 0x00040020,
+	0x00000017, 0x00000000, 0x00000016, 0x00040020, 0x00000018, 0x00000001, 0x00000009, 0x0004002b,
+	0x00000005, 0x00000019, 0x00000000, 0x0004002b, 0x00000005, 0x0000001a, 0x00000001, 0x0004002b,
+	0x00000006, 0x0000001b, 0x00000001, 0x0004002b, 0x00000006, 0x0000001c, 0x00000005, 0x0004002b,
+	0x00000006, 0x0000001d, 0x0000001f, 0x0004003b, 0x00000018, 0x0000001e, 0x00000001, 0x0004003b,
+	0x00000017, 0x0000001f, 0x00000000, 0x0004003b, 0x0000000e, 0x00000020, 0x00000000, 0x0004003b,
+	0x00000012, 0x00000021, 0x00000002, 0x0004003b, 0x00000014, 0x00000022, 0x00000003, 0x00050036,
+	0x00000003, 0x00000002, 0x00000000, 0x00000004, 0x000200f8, 0x00000023, 0x0004003d, 0x00000009,
+	0x00000024, 0x0000001e, 0x00050051, 0x00000007, 0x00000025, 0x00000024, 0x00000000, 0x0004006e,
+	0x00000005, 0x00000026, 0x00000025, 0x00050051, 0x00000007, 0x00000027, 0x00000024, 0x00000001,
+	0x0004006e, 0x00000005, 0x00000028, 0x00000027, 0x0004007c, 0x00000006, 0x00000029, 0x00000026,
+	0x000500c2, 0x00000006, 0x0000002a, 0x00000029, 0x0000001c, 0x000500c7, 0x00000006, 0x0000002b,
+	0x00000029, 0x0000001d, 0x00050082, 0x00000006, 0x0000002c, 0x0000001d, 0x0000002b, 0x0004003d,
+	0x00000016, 0x0000002d, 0x0000001f, 0x00040064, 0x00000015, 0x0000002e, 0x0000002d, 0x00050050,
+	0x0000000a, 0x0000002f, 0x00000019, 0x00000028, 0x0007005f, 0x0000000b, 0x00000030, 0x0000002e,
+	0x0000002f, 0x00000002, 0x00000019, 0x00050050, 0x0000000a, 0x00000031, 0x0000001a, 0x00000028,
+	0x0007005f, 0x0000000b, 0x00000032, 0x0000002e, 0x00000031, 0x00000002, 0x00000019, 0x0005004d,
+	0x00000006, 0x00000033, 0x00000030, 0x0000002a, 0x0005004d, 0x00000006, 0x00000034, 0x00000032,
+	0x0000002a, 0x000500c2, 0x00000006, 0x00000035, 0x00000033, 0x0000002c, 0x000500c7, 0x00000006,
+	0x00000036, 0x00000035, 0x0000001b, 0x000500c2, 0x00000006, 0x00000037, 0x00000034, 0x0000002c,
+	0x000500c7, 0x00000006, 0x00000038, 0x00000037, 0x0000001b, 0x000500c4, 0x00000006, 0x00000039,
+	0x00000038, 0x0000001b, 0x000500c5, 0x00000006, 0x0000003a, 0x00000036, 0x00000039, 0x00060041,
+	0x00000013, 0x0000003b, 0x00000021, 0x00000019, 0x0000003a, 0x0004003d, 0x00000009, 0x0000003c,
+	0x0000003b, 0x00050041, 0x00000013, 0x0000003d, 0x00000021, 0x0000001a, 0x0004003d, 0x00000009,
+	0x0000003e, 0x0000003d, 0x00050051, 0x00000007, 0x0000003f, 0x0000003e, 0x00000000, 0x0004003d,
+	0x0000000d, 0x00000040, 0x00000020, 0x00040064, 0x0000000c, 0x00000041, 0x00000040, 0x00050050,
+	0x0000000a, 0x00000042, 0x00000026, 0x00000028, 0x0007005f, 0x00000009, 0x00000043, 0x00000041,
+	0x00000042, 0x00000002, 0x00000019, 0x0005008e, 0x00000009, 0x00000044, 0x00000043, 0x0000003f,
+	0x0007000c, 0x00000009, 0x00000045, 0x00000001, 0x00000028, 0x0000003c, 0x00000044, 0x0003003e,
+	0x00000022, 0x00000045, 0x000100fd, 0x00010038,
+};
+
+static const Uint32 output_spirv[] = {
+	0x07230203, 0x00010000, 0x00000000, 0x00000036, 0x00000000, 0x00020011, 0x00000001, 0x0006000b,
+	0x00000001, 0x4c534c47, 0x6474732e, 0x3035342e, 0x00000000, 0x0003000e, 0x00000000, 0x00000001,
+	0x0007000f, 0x00000004, 0x00000002, 0x6e69616d, 0x00000000, 0x0000001a, 0x0000001d, 0x00030010,
+	0x00000002, 0x00000007, 0x00040047, 0x00000010, 0x00000006, 0x00000010, 0x00030047, 0x00000011,
+	0x00000002, 0x00050048, 0x00000011, 0x00000000, 0x00000023, 0x00000000, 0x00050048, 0x00000011,
+	0x00000001, 0x00000023, 0x00000040, 0x00040047, 0x0000001a, 0x0000001e, 0x00000000, 0x00040047,
+	0x0000001b, 0x00000022, 0x00000002, 0x00040047, 0x0000001b, 0x00000021, 0x00000000, 0x00040047,
+	0x0000001c, 0x00000022, 0x00000003, 0x00040047, 0x0000001c, 0x00000021, 0x00000000, 0x00040047,
+	0x0000001d, 0x0000001e, 0x00000000, 0x00020013, 0x00000003, 0x00030021, 0x00000004, 0x00000003,
+	0x00040015, 0x00000005, 0x00000020, 0x00000001, 0x00040015, 0x00000006, 0x00000020, 0x00000000,
+	0x00030016, 0x00000007, 0x00000020, 0x00040017, 0x00000008, 0x00000007, 0x00000002, 0x00040017,
+	0x00000009, 0x00000007, 0x00000004, 0x00040017, 0x0000000a, 0x00000005, 0x00000002, 0x00040017,
+	0x0000000b, 0x00000006, 0x00000004, 0x00090019, 0x0000000c, 0x00000007, 0x00000001, 0x00000000,
+	0x00000000, 0x00000000, 0x00000001, 0x00000000, 0x0003001b, 0x0000000d, 0x0000000c, 0x00040020,
+	0x0000000e, 0x00000000, 0x0000000d, 0x0004002b, 0x00000006, 0x0000000f, 0x00000004, 0x0004001c,
+	0x00000010, 0x00000009, 0x0000000f, 0x0004001e, 0x00000011, 0x00000010, 0x00000009, 0x00040020,
+	0x00000012, 0x00000002, 0x00000011, 0x00040020, 0x00000013, 0x00000002, 0x00000009, 0x00040020,
+	0x00000014, 0x00000003, 0x00000009, 0x00040020, 0x00000015, 0x00000001, 0x00000008, 0x0004002b,
+	0x00000005, 0x00000016, 0x00000000, 0x0004002b, 0x00000005, 0x00000017, 0x00000001, 0x0004002b,
+	0x00000007, 0x00000018, 0x3f800000, 0x0004002b, 0x00000007, 0x00000019, 0x40000000, 0x0004003b,
+	0x00000015, 0x0000001a, 0x00000001, 0x0004003b, 0x0000000e, 0x0000001b, 0x00000000, 0x0004003b,
+	0x00000012, 0x0000001c, 0x00000002, 0x0004003b, 0x00000014, 0x0000001d, 0x00000003, 0x00050036,
+	0x00000003, 0x00000002, 0x00000000, 0x00000004, 0x000200f8, 0x0000001e, 0x0004003d, 0x00000008,
+	0x0000001f, 0x0000001a, 0x00050041, 0x00000013, 0x00000020, 0x0000001c, 0x00000017, 0x0004003d,
+	0x00000009, 0x00000021, 0x00000020, 0x00050051, 0x00000007, 0x00000022, 0x0000001f, 0x00000000,
+	0x00050051, 0x00000007, 0x00000023, 0x00000021, 0x00000002, 0x00050085, 0x00000007, 0x00000024,
+	0x00000022, 0x00000023, 0x00050051, 0x00000007, 0x00000025, 0x0000001f, 0x00000001, 0x00050051,
+	0x00000007, 0x00000026, 0x00000021, 0x00000003, 0x00050085, 0x00000007, 0x00000027, 0x00000025,
+	0x00000026, 0x0004003d, 0x0000000d, 0x00000028, 0x0000001b, 0x00040064, 0x0000000c, 0x00000029,
+	0x00000028, 0x0004006e, 0x00000005, 0x0000002a, 0x00000024, 0x0004006e, 0x00000005, 0x0000002b,
+	0x00000027, 0x00050050, 0x0000000a, 0x0000002c, 0x0000002a, 0x0000002b, 0x0007005f, 0x00000009,
+	0x0000002d, 0x00000029, 0x0000002c, 0x00000002, 0x00000016, 0x0006000c, 0x00000007, 0x0000002e,
+	0x00000001, 0x0000000a, 0x00000027, 0x00050085, 0x00000007, 0x0000002f, 0x0000002e, 0x00000019,
+	0x00050083, 0x00000007, 0x00000030, 0x0000002f, 0x00000018, 0x0006000c, 0x00000007, 0x00000031,
+	0x00000001, 0x00000004, 0x00000030, 0x00050051, 0x00000007, 0x00000032, 0x00000021, 0x00000001,
+	0x00050085, 0x00000007, 0x00000033, 0x00000032, 0x00000031, 0x00050083, 0x00000007, 0x00000034,
+	0x00000018, 0x00000033, 0x0005008e, 0x00000009, 0x00000035, 0x0000002d, 0x00000034, 0x0003003e,
+	0x0000001d, 0x00000035, 0x000100fd, 0x00010038,
+};
+static const char shader_msl[] =
+	"#include <metal_stdlib>\n"
+	"using namespace metal;\n"
+	"struct varyings { float4 position [[position]]; float2 uv [[user(locn0)]]; };\n"
+	"struct params { float4 palette[4]; float4 effect; };\n"
+	"vertex varyings fullscreen_vertex(uint id [[vertex_id]]) {\n"
+	"    varyings out;\n"
+	"    out.uv = float2(float((id << 1) & 2), float(id & 2));\n"
+	"    out.position = float4(out.uv * float2(2, -2) + float2(-1, 1), 0, 1);\n"
+	"    return out;\n"
+	"}\n"
+	"fragment float4 persist_fragment(float4 position [[position]], constant params& p [[buffer(0)]],\n"
+	"    texture2d<uint> display [[texture(0)]], texture2d<float> previous [[texture(1)]]) {\n"
+	"    uint2 xy = uint2(position.xy);\n"
+	"    uint word = xy.x >> 5, bit = 31 - (xy.x & 31);\n"
+	"    uint b0 = (display.read(uint2(0, xy.y))[word] >> bit) & 1;\n"
+	"    uint b1 = (display.read(uint2(1, xy.y))[word] >> bit) & 1;\n"
+	"    return max(p.palette[b0 | b1 << 1], previous.read(xy) * p.effect.x);\n"
+	"}\n"
+	"fragment float4 output_fragment(varyings in [[stage_in]], constant params& p [[buffer(0)]],\n"
+	"    texture2d<float> image [[texture(0)]]) {\n"
+	"    float2 source = in.uv * p.effect.zw;\n"
+	"    float shade = 1 - p.effect.y * abs(fract(source.y) * 2 - 1);\n"
+	"    return image.read(uint2(source)) * shade;\n"
+	"}\n";
+
+static SDL_GPUShader* create_shader(SDL_GPUDevice* device, SDL_GPUShaderStage stage, const Uint32* spirv, size_t spirv_size,
+	const char* msl_entry, Uint32 samplers, Uint32 uniform_buffers)
+{
+	SDL_GPUShaderCreateInfo info = { 0 };
+	if (SDL_GetGPUShaderFormats(device) & SDL_GPU_SHADERFORMAT_SPIRV)
+	{
+		info.code = (const Uint8*)spirv;
+		info.code_size = spirv_size;
+		info.entrypoint = "main";
+		info.format = SDL_GPU_SHADERFORMAT_SPIRV;
+	}
+	else
+	{
+		info.code = (const Uint8*)shader_msl;
+		info.code_size = sizeof(shader_msl) - 1;
+		info.entrypoint = msl_entry;
+		info.format = SDL_GPU_SHADERFORMAT_MSL;
+	}
+	info.stage = stage;
+	info.num_samplers = samplers;
+	info.num_uniform_buffers = uniform_buffers;
+
+	SDL_GPUShader* shader = SDL_CreateGPUShader(device, &info);
+	if (!shader)
+		printf("SDL_CreateGPUShader Error: %s\n", SDL_GetError());
+	return shader;
+}
+
+// A pipeline drawing the fullscreen triangle with the given fragment shader
+static SDL_GPUGraphicsPipeline* create_pipeline(SDL_GPUDevice* device, SDL_GPUShader* vertex, SDL_GPUShader* fragment, SDL_GPUTextureFormat format)
+{
+	SDL_GPUColorTargetDescription target = { 0 };
+	target.format = format;
+
+	SDL_GPUGraphicsPipelineCreateInfo info = { 0 };
+	info.vertex_shader = vertex;
+	info.fragment_shader = fragment;
+	info.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST;
+	info.rasterizer_state.fill_mode = SDL_GPU_FILLMODE_FILL;
+	info.rasterizer_state.cull_mode = SDL_GPU_CULLMODE_NONE;
+	info.target_info.color_target_descriptions = &target;
+	info.target_info.num_color_targets = 1;
+
+	SDL_GPUGraphicsPipeline* pipeline = SDL_CreateGPUGraphicsPipeline(device, &info);
+	if (!pipeline)
+		printf("SDL_CreateGPUGraphicsPipeline Error: %s\n", SDL_GetError());
+	return pipeline;
+}
+
+static SDL_GPUTexture* create_texture(SDL_GPUDevice* device, SDL_GPUTextureFormat format, SDL_GPUTextureUsageFlags usage, Uint32 width, Uint32 height)
+{
+	SDL_GPUTextureCreateInfo info = { 0 };
+	info.type = SDL_GPU_TEXTURETYPE_2D;
+	info.format = format;
+	info.usage = usage;
+	info.width = width;
+	info.height = height;
+	info.layer_count_or_depth = 1;
+	info.num_levels = 1;
+
+	SDL_GPUTexture* texture = SDL_CreateGPUTexture(device, &info);
+	if (!texture)
+		printf("SDL_CreateGPUTexture Error: %s\n", SDL_GetError());
+	return texture;
+}
+
+static int create_pipelines(gpu_t* gpu)
+{
+	SDL_GPUShader* vertex = create_shader(gpu->device, SDL_GPU_SHADERSTAGE_VERTEX,
+		fullscreen_spirv, sizeof(fullscreen_spirv), "fullscreen_vertex", 0, 0);
+	SDL_GPUShader* persist = create_shader(gpu->device, SDL_GPU_SHADERSTAGE_FRAGMENT,
+		persist_spirv, sizeof(persist_spirv), "persist_fragment", 2, 1);
+	SDL_GPUShader* output = create_shader(gpu->device, SDL_GPU_SHADERSTAGE_FRAGMENT,
+		output_spirv, sizeof(output_spirv), "output_fragment", 1, 1);
+
+	if (vertex && persist && output)
+	{
+		gpu->persist = create_pipeline(gpu->device, vertex, persist, SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM);
+		gpu->output = create_pipeline(gpu->device, vertex, output, SDL_GetGPUSwapchainTextureFormat(gpu->device, gpu->window));
+	}
+
+	// Pipelines keep what they need, the shaders can go either way
+	if (vertex)
+		SDL_ReleaseGPUShader(gpu->device, vertex);
+	if (persist)
+		SDL_ReleaseGPUShader(gpu->device, persist);
+	if (output)
+		SDL_ReleaseGPUShader(gpu->device, output);
+	return gpu->persist && gpu->output ? 1 : -1;
+}
+
+// Starts both phosphor images out black
+static void clear_images(gpu_t* gpu)
+{
+	SDL_GPUCommandBuffer* cmd = SDL_AcquireGPUCommandBuffer(gpu->device);
+	if (!cmd)
+		return;
+
+	for (int i = 0; i < 2; i++)
+	{
+		SDL_GPUColorTargetInfo target = { 0 };
+		target.texture = gpu->image[i];
+		target.clear_color.a = 1.0f;
+		target.load_op = SDL_GPU_LOADOP_CLEAR;
+		target.store_op = SDL_GPU_STOREOP_STORE;
+		SDL_EndGPURenderPass(SDL_BeginGPURenderPass(cmd, &target, 1, NULL));
+	}
+	SDL_SubmitGPUCommandBuffer(cmd);
+}
+
+// Takes over window for rendering. Returns -1 if there's no usable GPU
+// device, leaving the window free for SDL_Renderer.
+int gpu_init(gpu_t* gpu, SDL_Window* window, const Uint32 palette[4], float phosphor, float scanlines)
+{
+	memset(gpu, 0, sizeof(*gpu));
+	gpu->window = window;
+	gpu->phosphor = phosphor;
+	gpu->scanlines = scanlines;
+	gpu->width = CHIP8_LORES_WIDTH;
+	gpu->height = CHIP8_LORES_HEIGHT;
+	for (int i = 0; i < 4; i++)
+	{
+		gpu->palette[i][0] = ((palette[i] >> 16) & 0xFF) / 255.0f;
+		gpu->palette[i][1] = ((palette[i] >> 8) & 0xFF) / 255.0f;
+		gpu->palette[i][2] = (palette[i] & 0xFF) / 255.0f;
+		gpu->palette[i][3] = 1.0f;
+	}
+
+	gpu->device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV | SDL_GPU_SHADERFORMAT_MSL, false, NULL);
+	if (!gpu->device)
+	{
+		printf("No GPU device (%s), using SDL_Renderer\n", SDL_GetError());
+		return -1;
+	}
+	if (!SDL_ClaimWindowForGPUDevice(gpu->device, window))
+	{
+		printf("SDL_ClaimWindowForGPUDevice Error: %s\n", SDL_GetError());
+		SDL_DestroyGPUDevice(gpu->device);
+		gpu->device = NULL;
+		return -1;
+	}
+
+	if (!SDL_GPUTextureSupportsFormat(gpu->device, SDL_GPU_TEXTUREFORMAT_R32G32B32A32_UINT, SDL_GPU_TEXTURETYPE_2D, SDL_GPU_TEXTUREUSAGE_SAMPLER))
+	{
+		printf("GPU can't sample RGBA32UI textures, using SDL_Renderer\n");
+		gpu_quit(gpu);
+		return -1;
+	}
+
+	SDL_GPUSamplerCreateInfo sampler = { 0 };
+	sampler.min_filter = SDL_GPU_FILTER_NEAREST;
+	sampler.mag_filter = SDL_GPU_FILTER_NEAREST;
+	sampler.mipmap_mode = SDL_GPU_SAMPLERMIPMAPMODE_NEAREST;
+	sampler.address_mode_u = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+	sampler.address_mode_v = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+	sampler.address_mode_w = SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE;
+	gpu->sampler = SDL_CreateGPUSampler(gpu->device, &sampler);
+
+	SDL_GPUTransferBufferCreateInfo upload = { 0 };
+	upload.usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD;
+	upload.size = sizeof(gpu->rows);
+	gpu->upload = SDL_CreateGPUTransferBuffer(gpu->device, &upload);
+
+	gpu->display = create_texture(gpu->device, SDL_GPU_TEXTUREFORMAT_R32G32B32A32_UINT, SDL_GPU_TEXTUREUSAGE_SAMPLER, CHIP8_PLANES, CHIP8_HIRES_HEIGHT);
+	for (int i = 0; i < 2; i++)
+	{
+		gpu->image[i] = create_texture(gpu->device, SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM,
+			SDL_GPU_TEXTUREUSAGE_SAMPLER | SDL_GPU_TEXTUREUSAGE_COLOR_TARGET, CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+	}
+
+	if (!gpu->sampler || !gpu->upload || !gpu->display || !gpu->image[0] || !gpu->image[1] || create_pipelines(gpu) < 0)
+	{
+		printf("GPU renderer setup failed (%s), using SDL_Renderer\n", SDL_GetError());
+		gpu_quit(gpu);
+		return -1;
+	}
+
+	clear_images(gpu);
+	gpu->pending = 1;
+	gpu->last_present = SDL_GetTicksNS();
+	return 1;
+}
+
+// Repacks the changed rows for the next present; the upload itself is the
+// whole 2 KB, since that's cheaper than tracking ranges on the GPU side
+void gpu_upload(gpu_t* gpu, const frame_t* frame, uint64_t changed)
+{
+	for (int p = 0; p < CHIP8_PLANES; p++)
+	{
+		for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+		{
+			if (!((changed >> y) & 1))
+				continue;
+			const uint64_t* row = frame->display[p][y];
+			gpu->rows[y][p][0] = (Uint32)(row[0] >> 32);
+			gpu->rows[y][p][1] = (Uint32)row[0];
+			gpu->rows[y][p][2] = (Uint32)(row[1] >> 32);
+			gpu->rows[y][p][3] = (Uint32)row[1];
+		}
+	}
+	gpu->width = frame->width;
+	gpu->height = frame->height;
+	gpu->pending = 1;
+}
+
+// Draws the newest frame into dst, given in window coordinates. Each call
+// advances the phosphor decay by the time since the last one, so with
+// persistence on it's worth presenting even when no new frame came in.
+void gpu_present(gpu_t* gpu, const SDL_FRect* dst)
+{
+	SDL_GPUCommandBuffer* cmd = SDL_AcquireGPUCommandBuffer(gpu->device);
+	if (!cmd)
+		return;
+
+	if (gpu->pending)
+	{
+		void* mapped = SDL_MapGPUTransferBuffer(gpu->device, gpu->upload, true);
+		if (mapped)
+		{
+			memcpy(mapped, gpu->rows, sizeof(gpu->rows));
+			SDL_UnmapGPUTransferBuffer(gpu->device, gpu->upload);
+
+			SDL_GPUTextureTransferInfo source = { gpu->upload, 0, CHIP8_PLANES, CHIP8_HIRES_HEIGHT };
+			SDL_GPUTextureRegion region = { 0 };
+			region.texture = gpu->display;
+			region.w = CHIP8_PLANES;
+			region.h = CHIP8_HIRES_HEIGHT;
+			region.d = 1;
+
+			SDL_GPUCopyPass* copy = SDL_BeginGPUCopyPass(cmd);
+			SDL_UploadToGPUTexture(copy, &source, &region, true);
+			SDL_EndGPUCopyPass(copy);
+			gpu->pending = 0;
+		}
+	}
+
+	SDL_GPUTexture* swapchain;
+	Uint32 swapchain_width, swapchain_height;
+	if (!SDL_WaitAndAcquireGPUSwapchainTexture(cmd, gpu->window, &swapchain, &swapchain_width, &swapchain_height) || !swapchain)
+	{
+		SDL_SubmitGPUCommandBuffer(cmd); // minimized, or the upload still needs to happen
+		return;
+	}
+
+	// Decay is specified per 60 Hz frame; scale it to the real interval so
+	// trails look the same at any refresh rate
+	Uint64 now = SDL_GetTicksNS();
+	float frames = (float)(now - gpu->last_present) * 60.0f / SDL_NS_PER_SECOND;
+	gpu->last_present = now;
+	gpu_params_t params;
+	memcpy(params.palette, gpu->palette, sizeof(params.palette));
+	params.effect[0] = gpu->phosphor > 0 ? SDL_powf(gpu->phosphor, frames > 0 ? frames : 1) : 0;
+	params.effect[1] = gpu->scanlines;
+	params.effect[2] = (float)gpu->width;
+	params.effect[3] = (float)gpu->height;
+
+	int next = gpu->current ^ 1;
+	SDL_GPUColorTargetInfo target = { 0 };
+	target.texture = gpu->image[next];
+	target.load_op = SDL_GPU_LOADOP_DONT_CARE;
+	target.store_op = SDL_GPU_STOREOP_STORE;
+
+	SDL_GPURenderPass* pass = SDL_BeginGPURenderPass(cmd, &target, 1, NULL);
+	SDL_GPUTextureSamplerBinding inputs[2] = {
+		{ gpu->display, gpu->sampler },
+		{ gpu->image[gpu->current], gpu->sampler },
+	};
+	SDL_BindGPUGraphicsPipeline(pass, gpu->persist);
+	SDL_BindGPUFragmentSamplers(pass, 0, inputs, 2);
+	SDL_PushGPUFragmentUniformData(cmd, 0, &params, sizeof(params));
+	SDL_DrawGPUPrimitives(pass, 3, 1, 0, 0);
+	SDL_EndGPURenderPass(pass);
+	gpu->current = next;
+
+	// The swapchain may be larger than the window on high-DPI displays
+	int window_width, window_height;
+	SDL_GetWindowSize(gpu->window, &window_width, &window_height);
+	float scale = window_width > 0 ? (float)swapchain_width / window_width : 1.0f;
+
+	target.texture = swapchain;
+	target.load_op = SDL_GPU_LOADOP_CLEAR;
+	target.clear_color.a = 1.0f;
+	SDL_GPUViewport viewport = { dst->x * scale, dst->y * scale, dst->w * scale, dst->h * scale, 0.0f, 1.0f };
+	SDL_GPUTextureSamplerBinding image = { gpu->image[gpu->current], gpu->sampler };
+
+	pass = SDL_BeginGPURenderPass(cmd, &target, 1, NULL);
+	SDL_BindGPUGraphicsPipeline(pass, gpu->output);
+	SDL_SetGPUViewport(pass, &viewport);
+	SDL_BindGPUFragmentSamplers(pass, 0, &image, 1);
+	SDL_PushGPUFragmentUniformData(cmd, 0, &params, sizeof(params));
+	SDL_DrawGPUPrimitives(pass, 3, 1, 0, 0);
+	SDL_EndGPURenderPass(pass);
+
+	SDL_SubmitGPUCommandBuffer(cmd);
+}
+
+// Releases everything and gives the window back; also undoes a partial
+// gpu_init()
+void gpu_quit(gpu_t* gpu)
+{
+	if (!gpu->device)
+		return;
+
+	SDL_WaitForGPUIdle(gpu->device);
+	if (gpu->persist)
+		SDL_ReleaseGPUGraphicsPipeline(gpu->device, gpu->persist);
+	if (gpu->output)
+		SDL_ReleaseGPUGraphicsPipeline(gpu->device, gpu->output);
+	if (gpu->sampler)
+		SDL_ReleaseGPUSampler(gpu->device, gpu->sampler);
+	if (gpu->upload)
+		SDL_ReleaseGPUTransferBuffer(gpu->device, gpu->upload);
+	if (gpu->display)
+		SDL_ReleaseGPUTexture(gpu->device, gpu->display);
+	for (int i = 0; i < 2; i++)
+	{
+		if (gpu->image[i])
+			SDL_ReleaseGPUTexture(gpu->device, gpu->image[i]);
+	}
+	SDL_ReleaseWindowFromGPUDevice(gpu->device, gpu->window);
+	SDL_DestroyGPUDevice(gpu->device);
+	gpu->device = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef _GPU_H
+#define _GPU_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "frame.h"
+
+// Optional renderer on the SDL GPU API. The display goes up as it is stored,
+// one bit per pixel (2 KB for both planes), and two fragment shaders do the
+// rest: the first expands the bits through the palette into a native-size
+// image, keeping whatever is brighter of the new pixel and the previous
+// image faded by the phosphor decay; the second scales that image to the
+// window with optional scanlines. No per-pixel work is left on the CPU.
+//
+// Shaders ship as SPIR-V and MSL, so this needs a Vulkan or Metal device;
+// gpu_init() fails cleanly anywhere else and the caller falls back to
+// SDL_Renderer.
+typedef struct {
+	SDL_GPUDevice* device;
+	SDL_Window* window;
+	SDL_GPUGraphicsPipeline* persist; // display bits + previous image -> next image
+	SDL_GPUGraphicsPipeline* output; // image -> swapchain
+	SDL_GPUSampler* sampler;
+	SDL_GPUTexture* display; // 2 x 64 RGBA32UI, texel (p, y) is row y of plane p
+	SDL_GPUTexture* image[2]; // native-size phosphor images, drawn alternately
+	SDL_GPUTransferBuffer* upload;
+	int current; // image holding the last output
+	int pending; // rows has changes that haven't been uploaded
+	int width; // display size of the newest frame
+	int height;
+	float palette[4][4];
+	float phosphor; // brightness an unlit pixel keeps after 1/60 s, 0 for none
+	float scanlines; // darkening between display rows, 0 for none
+	Uint64 last_present; // ns
+	// Upload image for the display texture, so row-major: texel (p, y) is
+	// rows[y][p], four 32-bit words with the leftmost pixel in the MSB of
+	// word 0
+	Uint32 rows[CHIP8_HIRES_HEIGHT][CHIP8_PLANES][4];
+} gpu_t;
+
+int gpu_init(gpu_t* gpu, SDL_Window* window, const Uint32 palette[4], float phosphor, float scanlines);
+void gpu_upload(gpu_t* gpu, const frame_t* frame, uint64_t changed);
+void gpu_present(gpu_t* gpu, const SDL_FRect* dst);
+void gpu_quit(gpu_t* gpu);
+#endif
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <string.h>
+#include "grid.h"
+#include "rom.h"
+#include "video.h"
+
+#define GRID_FRESH 4
+#define GRID_FRAME_NS (SDL_NS_PER_SECOND / 60)
+
+// Loads a ROM into a template with whatever chip8_rom_lookup() knows about
+// it, overridden by the command line. Unknown ROMs too big for 4 KB are
+// taken to be XO-CHIP.
+static int load_template(chip8_t* cpu, const char* filename, const chip8_rom_override_t* override)
+{
+	chip8_rom_t image;
+	if (chip8_rom_map(&image, filename) < 0)
+		return -1;
+
+	const chip8_rom_info_t* info = chip8_rom_lookup(image.data, image.size);
+	chip8_platform_t platform = info ? info->platform : image.size > CHIP8_MAX_ROM_SIZE ? CHIP8_PLATFORM_XOCHIP : CHIP8_PLATFORM_CHIP8;
+	if (override->platform >= 0)
+		platform = override->platform;
+	if (chip8_init(cpu, platform) < 0)
+	{
+		chip8_rom_unmap(&image);
+		return -1;
+	}
+	if (info)
+	{
+		if (info->platform == platform)
+			chip8_set_quirks(cpu, info->quirks);
+		chip8_set_cycles_per_frame(cpu, info->cycles_per_frame);
+		chip8_set_idle_pc(cpu, info->idle_pc ? info->idle_pc : -1);
+	}
+	if (override->quirks >= 0)
+		chip8_set_quirks(cpu, override->quirks);
+	if (override->cycles_per_frame > 0)
+		chip8_set_cycles_per_frame(cpu, override->cycles_per_frame);
+
+	int ret = chip8_load_rom_mem(cpu, image.data, image.size);
+	chip8_rom_unmap(&image);
+	if (ret < 0)
+		free_cpu(cpu);
+	return ret;
+}
+
+static int SDLCALL worker_thread(void* data)
+{
+	grid_worker_t* worker = data;
+	grid_t* grid = worker->grid;
+	int pitch = grid->width * (int)sizeof(Uint32);
+
+	for (;;)
+	{
+		SDL_WaitSemaphore(worker->start);
+		if (SDL_GetAtomicInt(&grid->stopping))
+			break;
+
+		Uint16 keys = (Uint16)SDL_GetAtomicInt(&grid->keys);
+		Uint32* atlas = grid->atlas[grid->back];
+		for (int i = worker->first; i < worker->last; i++)
+		{
+			chip8_t* cpu = &grid->cells[i];
+			chip8_set_keys(cpu, keys);
+			emulate_frame(cpu);
+
+			int width = chip8_get_width(cpu);
+			Uint32* out = atlas + (i / grid->cols) * GRID_CELL_HEIGHT * grid->width + (i % grid->cols) * GRID_CELL_WIDTH;
+			video_expand((const uint64_t (*)[CHIP8_HIRES_HEIGHT][2])cpu->display, width, 0, chip8_get_height(cpu),
+				grid->palette, GRID_CELL_WIDTH / width, out, pitch);
+		}
+		SDL_SignalSemaphore(grid->done);
+	}
+
+	return 0;
+}
+
+// Clocks the grid at 60 Hz: starts every worker on the back atlas, waits
+// for all of them, then publishes it
+static int SDLCALL driver_thread(void* data)
+{
+	grid_t* grid = data;
+	Uint64 next_frame = SDL_GetTicksNS();
+
+	while (SDL_GetAtomicInt(&grid->running))
+	{
+		for (int w = 0; w < grid->worker_count; w++)
+			SDL_SignalSemaphore(grid->workers[w].start);
+		for (int w = 0; w < grid->worker_count; w++)
+			SDL_WaitSemaphore(grid->done);
+
+		int old = SDL_SetAtomicInt(&grid->middle, grid->back | GRID_FRESH);
+		grid->back = old & 3;
+
+		next_frame += GRID_FRAME_NS;
+		Uint64 now = SDL_GetTicksNS();
+		if (next_frame > now)
+			SDL_DelayNS(next_frame - now);
+		else
+			next_frame = now; // fell behind, don't try to catch up
+	}
+
+	return 0;
+}
+
+// Sets up cols x rows instances, cycling through roms, and starts them.
+// Cell n is seeded with seed + n. video_init() must have been called.
+int grid_init(grid_t* grid, int cols, int rows, const char* const* roms, int rom_count, Uint32 seed,
+	const chip8_rom_override_t* override, const Uint32 palette[4])
+{
+	memset(grid, 0, sizeof(*grid));
+	if (cols < 1 || rows < 1 || cols * rows > GRID_MAX_CELLS || rom_count < 1)
+	{
+		printf("Grid must have between 1 and %d cells\n", GRID_MAX_CELLS);
+		return -1;
+	}
+
+	grid->cols = cols;
+	grid->rows = rows;
+	grid->width = cols * GRID_CELL_WIDTH;
+	grid->height = rows * GRID_CELL_HEIGHT;
+	memcpy(grid->palette, palette, sizeof(grid->palette));
+	grid->front = 2;
+	grid->back = 0;
+	SDL_SetAtomicInt(&grid->middle, 1);
+
+	for (int i = 0; i < 3; i++)
+	{
+		grid->atlas[i] = SDL_calloc((size_t)grid->width * grid->height, sizeof(Uint32));
+		if (!grid->atlas[i])
+		{
+			printf("Could not allocate grid atlas\n");
+			grid_quit(grid);
+			return -1;
+		}
+	}
+
+	grid->templates = SDL_aligned_alloc(CHIP8_CACHE_LINE, rom_count * sizeof(chip8_t));
+	grid->cells = SDL_aligned_alloc(CHIP8_CACHE_LINE, cols * rows * sizeof(chip8_t));
+	if (!grid->templates || !grid->cells)
+	{
+		printf("Could not allocate grid instances\n");
+		grid_quit(grid);
+		return -1;
+	}
+
+	for (; grid->template_count < rom_count; grid->template_count++)
+	{
+		if (load_template(&grid->templates[grid->template_count], roms[grid->template_count], override) < 0)
+		{
+			grid_quit(grid);
+			return -1;
+		}
+	}
+
+	for (; grid->count < cols * rows; grid->count++)
+	{
+		chip8_t* cpu = &grid->cells[grid->count];
+		if (chip8_clone(cpu, &grid->templates[grid->count % rom_count]) < 0)
+		{
+			grid_quit(grid);
+			return -1;
+		}
+		chip8_set_seed(cpu, seed + grid->count);
+	}
+
+	// Contiguous runs of cells per worker; every chip8_t fills whole cache
+	// lines, so neighbouring workers never share one
+	int workers = SDL_GetNumLogicalCPUCores();
+	if (workers > grid->count)
+		workers = grid->count;
+	if (workers > GRID_MAX_WORKERS)
+		workers = GRID_MAX_WORKERS;
+	if (workers < 1)
+		workers = 1;
+
+	grid->done = SDL_CreateSemaphore(0);
+	if (!grid->done)
+	{
+		printf("SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+		grid_quit(grid);
+		return -1;
+	}
+
+	SDL_SetAtomicInt(&grid->running, 1);
+	for (; grid->worker_count < workers; grid->worker_count++)
+	{
+		grid_worker_t* worker = &grid->workers[grid->worker_count];
+		worker->grid = grid;
+		worker->first = grid->count * grid->worker_count / workers;
+		worker->last = grid->count * (grid->worker_count + 1) / workers;
+		worker->start = SDL_CreateSemaphore(0);
+		worker->thread = worker->start ? SDL_CreateThread(worker_thread, "chip8 grid worker", worker) : NULL;
+		if (!worker->thread)
+		{
+			printf("Could not start grid worker: %s\n", SDL_GetError());
+			if (worker->start)
+				SDL_DestroySemaphore(worker->start);
+			grid_quit(grid);
+			return -1;
+		}
+	}
+
+	grid->driver = SDL_CreateThread(driver_thread, "chip8 grid", grid);
+	if (!grid->driver)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		grid_quit(grid);
+		return -1;
+	}
+	return 1;
+}
+
+// Returns the newest finished atlas (width x height pixels), or NULL if
+// nothing was published since the last call
+const Uint32* grid_acquire(grid_t* grid)
+{
+	if (!(SDL_GetAtomicInt(&grid->middle) & GRID_FRESH))
+		return NULL;
+
+	int old = SDL_SetAtomicInt(&grid->middle, grid->front);
+	grid->front = old & 3;
+	return grid->atlas[grid->front];
+}
+
+// Sets the keys held on every instance from the next frame on
+void grid_set_keys(grid_t* grid, Uint16 keys)
+{
+	SDL_SetAtomicInt(&grid->keys, keys);
+}
+
+// Stops the threads and frees everything; also undoes a partial grid_init()
+void grid_quit(grid_t* grid)
+{
+	// The driver may be mid-frame, so the workers keep serving it until it
+	// has gone
+	SDL_SetAtomicInt(&grid->running, 0);
+	if (grid->driver)
+		SDL_WaitThread(grid->driver, NULL);
+	SDL_SetAtomicInt(&grid->stopping, 1);
+	for (int w = 0; w < grid->worker_count; w++)
+	{
+		SDL_SignalSemaphore(grid->workers[w].start);
+		SDL_WaitThread(grid->workers[w].thread, NULL);
+		SDL_DestroySemaphore(grid->workers[w].start);
+	}
+	if (grid->done)
+		SDL_DestroySemaphore(grid->done);
+
+	// Clones go before the templates whose pages they share
+	for (int i = 0; i < grid->count; i++)
+		free_cpu(&grid->cells[i]);
+	for (int i = 0; i < grid->template_count; i++)
+		free_cpu(&grid->templates[i]);
+	SDL_aligned_free(grid->cells);
+	SDL_aligned_free(grid->templates);
+	for (int i = 0; i < 3; i++)
+		SDL_free(grid->atlas[i]);
+	memset(grid, 0, sizeof(*grid));
+}
@@ -0,0 +1,61 @@
+#ifndef _GRID_H
+#define _GRID_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "rom.h"
+
+#define GRID_MAX_CELLS 256
+#define GRID_MAX_WORKERS 32
+#define GRID_CELL_WIDTH CHIP8_HIRES_WIDTH // lo-res cells are doubled
+#define GRID_CELL_HEIGHT CHIP8_HIRES_HEIGHT
+
+// Many instances side by side in one atlas, for watching a batch of ROMs
+// (or one ROM under different seeds) at once. Each distinct ROM is loaded
+// into a template once and every cell running it is a copy-on-write clone.
+//
+// A driver thread clocks frames at 60 Hz. Each frame the workers split the
+// cells between them, run one frame of each and expand its display into
+// the atlas, so the whole grid costs the window a single texture upload.
+// Finished atlases reach the render thread through a triple buffer, the
+// same hand-off frame_buffer_t uses for a single display.
+typedef struct grid grid_t;
+
+typedef struct {
+	grid_t* grid;
+	int first; // cells [first, last) belong to this worker
+	int last;
+	SDL_Semaphore* start;
+	SDL_Thread* thread;
+} grid_worker_t;
+
+struct grid {
+	int cols;
+	int rows;
+	int count; // cols * rows
+	int width; // atlas size in pixels
+	int height;
+	chip8_t* templates; // one per ROM, never run
+	int template_count;
+	chip8_t* cells;
+	Uint32 palette[4];
+
+	Uint32* atlas[3];
+	SDL_AtomicInt middle; // atlas index, plus GRID_FRESH until the consumer takes it
+	int back; // driver and workers only
+	int front; // consumer only
+
+	grid_worker_t workers[GRID_MAX_WORKERS];
+	int worker_count;
+	SDL_Semaphore* done; // signalled by each worker when its cells finish a frame
+	SDL_Thread* driver;
+	SDL_AtomicInt running; // the driver's loop condition
+	SDL_AtomicInt stopping; // set after the driver exits, tells woken workers to leave
+	SDL_AtomicInt keys; // bit n is set while key n is held, fed to every cell
+};
+
+int grid_init(grid_t* grid, int cols, int rows, const char* const* roms, int rom_count, Uint32 seed,
+	const chip8_rom_override_t* override, const Uint32 palette[4]);
+const Uint32* grid_acquire(grid_t* grid);
+void grid_set_keys(grid_t* grid, Uint16 keys);
+void grid_quit(grid_t* grid);
+#endif
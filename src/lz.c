@@ -0,0 +1,141 @@
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+#define LZ_NO_POSITION 0xFFFFFFFFu
+
+static uint32_t read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint8_t* put_length(uint8_t* out, size_t n)
+{
+	while (n >= 255)
+	{
+		*out++ = 255;
+		n -= 255;
+	}
+	*out++ = (uint8_t)n;
+	return out;
+}
+
+// Each sequence is a token (literal count in the high nibble, match length
+// - 4 in the low one, 15 meaning more length bytes follow), the literals,
+// then a 16-bit little-endian offset. The final sequence has literals only.
+static uint8_t* put_sequence(uint8_t* out, const uint8_t* literals, size_t count, size_t match, size_t offset)
+{
+	uint8_t* token = out++;
+	*token = (uint8_t)((count < 15 ? count : 15) << 4);
+	if (count >= 15)
+		out = put_length(out, count - 15);
+	memcpy(out, literals, count);
+	out += count;
+
+	if (match)
+	{
+		size_t extra = match - LZ_MIN_MATCH;
+		*token |= extra < 15 ? extra : 15;
+		*out++ = (uint8_t)offset;
+		*out++ = (uint8_t)(offset >> 8);
+		if (extra >= 15)
+			out = put_length(out, extra - 15);
+	}
+	return out;
+}
+
+// Compresses len bytes into out, which must hold LZ_BOUND(len) bytes.
+// Returns the compressed size.
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	uint8_t* op = out;
+	size_t anchor = 0;
+	size_t i = 0;
+
+	memset(table, 0xFF, sizeof(table));
+
+	while (i + LZ_MIN_MATCH <= len)
+	{
+		uint32_t seq = read32(in + i);
+		uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		uint32_t candidate = table[hash];
+		table[hash] = (uint32_t)i;
+
+		if (candidate == LZ_NO_POSITION || i - candidate > LZ_MAX_OFFSET || read32(in + candidate) != seq)
+		{
+			i++;
+			continue;
+		}
+
+		size_t match = LZ_MIN_MATCH;
+		while (i + match < len && in[candidate + match] == in[i + match])
+			match++;
+
+		op = put_sequence(op, in + anchor, i - anchor, match, i - candidate);
+		i += match;
+		anchor = i;
+	}
+
+	op = put_sequence(op, in + anchor, len - anchor, 0, 0);
+	return (size_t)(op - out);
+}
+
+static int get_length(const uint8_t** in, const uint8_t* end, size_t* n)
+{
+	uint8_t b;
+	do
+	{
+		if (*in >= end)
+			return -1;
+		b = *(*in)++;
+		*n += b;
+	} while (b == 255);
+	return 0;
+}
+
+// Returns the decompressed size, or -1 if the input is corrupt or doesn't
+// fit in capacity bytes
+long lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t capacity)
+{
+	const uint8_t* end = in + len;
+	size_t op = 0;
+
+	while (in < end)
+	{
+		uint8_t token = *in++;
+
+		size_t count = token >> 4;
+		if (count == 15 && get_length(&in, end, &count) < 0)
+			return -1;
+		if (count > (size_t)(end - in) || count > capacity - op)
+			return -1;
+		memcpy(out + op, in, count);
+		in += count;
+		op += count;
+
+		if (in == end) // the last sequence has no match
+			break;
+
+		if (end - in < 2)
+			return -1;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		size_t match = (token & 15);
+		if (match == 15 && get_length(&in, end, &match) < 0)
+			return -1;
+		match += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > op || match > capacity - op)
+			return -1;
+		for (size_t i = 0; i < match; i++) // may overlap its own output
+			out[op + i] = out[op - offset + i];
+		op += match;
+	}
+
+	return (long)op;
+}
@@ -0,0 +1,14 @@
+#ifndef _LZ_H
+#define _LZ_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Worst-case compressed size of n bytes
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+// A small LZ77 byte-oriented codec in the style of LZ4: sequences of
+// literals followed by a back reference within the last 64 KB. It trades
+// ratio for speed, which suits large, repetitive streams like traces.
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out);
+long lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t capacity);
+#endif
@@ -1,28 +1,455 @@
 #include "../include/SDL3/SDL.h"
 #include <stdio.h>
+#include "audio.h"
+#include "capture.h"
 #include "cpu.h"
+#include "debug.h"
+#include "frame.h"
+#include "gpu.h"
+#include "grid.h"
+#include "persist.h"
+#include "rom.h"
+#include "trace.h"
+#include "video.h"
 
-#define CHIP8_HEIGHT 32
-#define CHIP8_WIDTH 64
-#define PIXEL_SIZE 10
+#define SCREEN_WIDTH 640 // 64 lo-res or 128 hi-res pixels across
+#define FRAME_NS (SDL_NS_PER_SECOND / 60)
+#define AUDIO_TARGET_FILL (AUDIO_SAMPLES_PER_FRAME * 3) // ~50 ms of queued beeper output
+
+// XRGB8888 pixel colour, indexed by (plane 1 bit << 1) | plane 0 bit; only
+// XO-CHIP ever sets plane 1
+static const Uint32 palette[4] = {
+	0xFF000000,
+	0xFFFFFFFF,
+	0xFFAAAAAA,
+	0xFF555555,
+};
+
+// Runs one 60 Hz frame, stopping early once the program reaches its idle
+// loop. Debugging and tracing go one instruction at a time; otherwise the
+// whole frame runs through emulate_frame().
+static void run_frame(chip8_t* cpu, trace_t* trace, debug_t* debug)
+{
+	if (!trace && !debug)
+	{
+		emulate_frame(cpu);
+		return;
+	}
+
+	update_timers(cpu);
+	if (debug)
+	{
+		debug_run_frame(debug, cpu, cpu->cycles_per_frame, cpu->idle_pc, trace);
+		return;
+	}
+	for (int i = 0; i < cpu->cycles_per_frame; i++)
+	{
+		trace_step(trace, cpu);
+		if (cpu->pc == cpu->idle_pc || cpu->halted || cpu->waiting)
+			break;
+	}
+}
+
+// The usual mapping of the hex keypad onto the left of a QWERTY keyboard:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D  ->  Q W E R
+//   7 8 9 E      A S D F
+//   A 0 B F      Z X C V
+static const SDL_Scancode keymap[16] = {
+	SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+	SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+	SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+	SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V,
+};
+
+// State shared between the main (render) thread and the emulation thread
+typedef struct {
+	chip8_t* cpu;
+	audio_t* audio;
+	frame_buffer_t* frames;
+	trace_t* trace; // NULL unless tracing
+	debug_t* debug; // NULL unless debugging
+	int audio_paced;
+	SDL_AtomicInt running;
+	SDL_AtomicInt keys; // bit n is set while key n is held, written by the main thread
+} emulator_t;
+
+// Emulation runs on its own thread so that a slow or vsync-blocked present
+// on the main thread can never hold it up; finished frames are handed over
+// through the triple buffer.
+static int SDLCALL emulation_thread(void* data)
+{
+	emulator_t* emu = data;
+	chip8_t* cpu = emu->cpu;
+	Uint64 next_frame = SDL_GetTicksNS();
+
+	while (SDL_GetAtomicInt(&emu->running))
+	{
+		chip8_set_keys(cpu, (uint16_t)SDL_GetAtomicInt(&emu->keys));
+		run_frame(cpu, emu->trace, emu->debug);
+		audio_push_frame(emu->audio, cpu);
+
+		if (cpu->draw_flag)
+		{
+			frame_buffer_publish(emu->frames, cpu);
+			cpu->draw_flag = 0;
+		}
+
+		if (emu->audio_paced)
+		{
+			// The audio device's clock drives emulation: only run the next
+			// frame once the beeper ring has drained below the target fill.
+			// The deadline keeps the loop live if the device stops pulling
+			// data.
+			Uint64 deadline = SDL_GetTicks() + 100;
+			while (audio_queued(emu->audio) >= AUDIO_TARGET_FILL && SDL_GetTicks() < deadline)
+				audio_wait(emu->audio, 10);
+		}
+		else
+		{
+			next_frame += FRAME_NS;
+			Uint64 now = SDL_GetTicksNS();
+			if (next_frame > now)
+				SDL_DelayNS(next_frame - now);
+			else
+				next_frame = now; // fell behind, don't try to catch up
+		}
+	}
+
+	return 0;
+}
+
+// Runs without a window or audio device, as fast as the host allows, for a
+// fixed number of frames. Every frame goes to the capture stream.
+static void run_headless(chip8_t* cpu, long frame_count, capture_t* capture, trace_t* trace)
+{
+	for (long frame = 0; frame < frame_count; frame++)
+	{
+		run_frame(cpu, trace, NULL);
+		capture_push(capture, cpu);
+	}
+}
+
+// Converts only the rows that changed into the streaming texture, one
+// upload per run of adjacent rows
+static void upload_frame(SDL_Texture* texture, const frame_t* frame, uint64_t changed)
+{
+	static Uint32 pixels[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+
+	int y = 0;
+	while (y < frame->height)
+	{
+		if (!((changed >> y) & 1))
+		{
+			y++;
+			continue;
+		}
+
+		int first = y;
+		while (y < frame->height && ((changed >> y) & 1))
+			y++;
+		video_expand(frame->display, frame->width, first, y - first, palette, 1, pixels[first], sizeof(pixels[0]));
+
+		SDL_Rect rect = { 0, first, frame->width, y - first };
+		SDL_UpdateTexture(texture, &rect, pixels[first], sizeof(pixels[0]));
+	}
+}
+
+// Where a width x height display goes in the window
+static SDL_FRect screen_rect(int width, int height)
+{
+	SDL_FRect dst = { 0, 0, SCREEN_WIDTH, SCREEN_WIDTH * height / width };
+	return dst;
+}
+
+// Scales the width x height corner of the texture to the window, with the
+// debugger overlay on top when debugging
+static void present(SDL_Renderer* renderer, SDL_Texture* texture, int width, int height, debug_t* debug)
+{
+	SDL_FRect src = { 0, 0, width, height };
+	SDL_FRect dst = screen_rect(width, height);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+	SDL_RenderTexture(renderer, texture, &src, &dst);
+	if (debug)
+		debug_draw_overlay(debug, renderer);
+	SDL_RenderPresent(renderer);
+}
+
+// Maps a key event onto a held-keys mask
+static int update_keys(int keys, const SDL_KeyboardEvent* key)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		if (keymap[i] == key->scancode)
+			keys = key->down ? keys | 1 << i : keys & ~(1 << i);
+	}
+	return keys;
+}
+
+// Grid mode: cols x rows instances in one window, all fed the same keys.
+// The grid runs itself on worker threads; this thread uploads each finished
+// atlas in one go and draws the cell borders over it.
+static int run_grid(int cols, int rows, const char* const* roms, int rom_count, Uint32 seed, const chip8_rom_override_t* override)
+{
+	if (!SDL_Init(SDL_INIT_VIDEO))
+	{
+		SDL_Log("SDL_Init Failed!");
+		return -1;
+	}
+	video_init();
+
+	// Cells are shown at 2x up to 320 pixels across, smaller for wide grids
+	int cell_width = 1280 / cols;
+	if (cell_width > 2 * GRID_CELL_WIDTH)
+		cell_width = 2 * GRID_CELL_WIDTH;
+	if (cell_width < GRID_CELL_WIDTH / 2)
+		cell_width = GRID_CELL_WIDTH / 2;
+	int cell_height = cell_width / 2;
+
+	SDL_Window* window = NULL;
+	SDL_Renderer* renderer = NULL;
+	if (!SDL_CreateWindowAndRenderer("CHIP8", cols * cell_width, rows * cell_height, 0, &window, &renderer))
+	{
+		printf("SDL_CreateWindowAndRenderer Error: %s\n", SDL_GetError());
+		SDL_Quit();
+		return -1;
+	}
+	SDL_SetRenderVSync(renderer, 1);
+
+	static grid_t grid;
+	if (grid_init(&grid, cols, rows, roms, rom_count, seed, override, palette) < 0)
+	{
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return -1;
+	}
+
+	SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, grid.width, grid.height);
+	if (!texture)
+	{
+		printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+		grid_quit(&grid);
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return -1;
+	}
+	SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+	int running = 1;
+	int keys = 0;
+	SDL_Event event;
+	while (running)
+	{
+		if (SDL_WaitEventTimeout(&event, 1))
+		{
+			do
+			{
+				if (event.type == SDL_EVENT_QUIT)
+					running = 0;
+				else if ((event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP) && !event.key.repeat)
+				{
+					keys = update_keys(keys, &event.key);
+					grid_set_keys(&grid, (Uint16)keys);
+				}
+			} while (SDL_PollEvent(&event));
+		}
+
+		const Uint32* pixels = grid_acquire(&grid);
+		if (!pixels)
+			continue;
+
+		SDL_UpdateTexture(texture, NULL, pixels, grid.width * (int)sizeof(Uint32));
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		SDL_RenderTexture(renderer, texture, NULL, NULL);
+		SDL_SetRenderDrawColor(renderer, 64, 64, 64, 255);
+		for (int x = 1; x < cols; x++)
+			SDL_RenderLine(renderer, x * cell_width, 0, x * cell_width, rows * cell_height);
+		for (int y = 1; y < rows; y++)
+			SDL_RenderLine(renderer, 0, y * cell_height, cols * cell_width, y * cell_height);
+		SDL_RenderPresent(renderer);
+	}
+
+	grid_quit(&grid);
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+	return 1;
+}
 
 int main(int argc, char const* argv[])
 {
-	const char* rom = argv[1];
+	const char* rom = NULL;
+	const char* roms[GRID_MAX_CELLS];
+	int rom_count = 0;
+	int grid_cols = 0;
+	int grid_rows = 0;
+	Uint32 seed = 0;
+	int audio_paced = 0;
+	const char* capture_file = NULL;
+	capture_format_t capture_format = CAPTURE_Y4M;
+	int capture_dedup = 0;
+	long frame_count = 60 * 60;
+	const char* trace_file = NULL;
+	int debugging = 0;
+	int use_gpu = 0;
+	float phosphor = 0.0f;
+	float scanlines = 0.0f;
+	int persist_frames = 1;
+	chip8_rom_override_t override = { -1, -1, -1 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (SDL_strcmp(argv[i], "--schip") == 0)
+			override.platform = CHIP8_PLATFORM_SCHIP;
+		else if (SDL_strcmp(argv[i], "--xochip") == 0)
+			override.platform = CHIP8_PLATFORM_XOCHIP;
+		else if (SDL_strcmp(argv[i], "--chip8") == 0)
+			override.platform = CHIP8_PLATFORM_CHIP8;
+		else if (SDL_strcmp(argv[i], "--quirks") == 0 && i + 1 < argc)
+			override.quirks = (int)(SDL_strtoul(argv[++i], NULL, 0) & ((1u << CHIP8_QUIRK_COUNT) - 1));
+		else if (SDL_strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+			override.cycles_per_frame = (int)SDL_strtol(argv[++i], NULL, 10);
+		else if (SDL_strcmp(argv[i], "--audio-pacing") == 0)
+			audio_paced = 1;
+		else if (SDL_strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			capture_file = argv[++i];
+		else if (SDL_strcmp(argv[i], "--capture-gray") == 0)
+			capture_format = CAPTURE_GRAY8;
+		else if (SDL_strcmp(argv[i], "--capture-dedup") == 0)
+			capture_dedup = 1;
+		else if (SDL_strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frame_count = SDL_strtol(argv[++i], NULL, 10);
+		else if (SDL_strcmp(argv[i], "--debug") == 0)
+			debugging = 1;
+		else if (SDL_strcmp(argv[i], "--gpu") == 0)
+			use_gpu = 1;
+		else if (SDL_strcmp(argv[i], "--phosphor") == 0 && i + 1 < argc)
+			phosphor = (float)SDL_strtod(argv[++i], NULL);
+		else if (SDL_strcmp(argv[i], "--scanlines") == 0 && i + 1 < argc)
+			scanlines = (float)SDL_strtod(argv[++i], NULL);
+		else if (SDL_strcmp(argv[i], "--persist") == 0 && i + 1 < argc)
+			persist_frames = (int)SDL_strtol(argv[++i], NULL, 10);
+		else if (SDL_strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			trace_file = argv[++i];
+		else if (SDL_strcmp(argv[i], "--grid") == 0 && i + 1 < argc)
+		{
+			char* end;
+			grid_cols = (int)SDL_strtol(argv[++i], &end, 10);
+			grid_rows = *end == 'x' ? (int)SDL_strtol(end + 1, NULL, 10) : 0;
+		}
+		else if (SDL_strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			seed = (Uint32)SDL_strtoul(argv[++i], NULL, 0);
+		else
+		{
+			rom = argv[i];
+			if (rom_count < GRID_MAX_CELLS)
+				roms[rom_count++] = rom;
+		}
+	}
+
 	if (!rom)
 	{
-		printf("Usage: chip8 <name_of_rom>");
+		printf("Usage: chip8 [--chip8 | --schip | --xochip] [--quirks <mask>] [--cycles <n>] [--audio-pacing] [--debug] [--gpu [--phosphor <0-1>] [--scanlines <0-1>]] [--persist <frames>] [--trace <file>] [--capture <file|-> [--capture-gray] [--capture-dedup] [--frames <n>]] <name_of_rom>\n");
+		printf("       chip8 --grid <cols>x<rows> [--seed <n>] [--chip8 | --schip | --xochip] [--quirks <mask>] [--cycles <n>] <rom>...\n");
+		printf("Quirk mask bits: 1 shift VY, 2 FX55/FX65 increment I, 4 BXNN, 8 VF reset, 16 clip sprites");
 		return -1;
 	}
 
+	if (grid_cols || grid_rows)
+		return run_grid(grid_cols, grid_rows, roms, rom_count, seed, &override);
+
+	chip8_rom_t image;
+	if (chip8_rom_map(&image, rom) < 0)
+		return -1;
+
+	// A ROM chip8_rom_lookup() recognizes comes with its platform, quirks
+	// and speed; anything else runs as CHIP-8, or XO-CHIP if it's too big
+	// for 4 KB, unless told otherwise. The recognized quirks only apply to
+	// the platform they were recorded for.
+	const chip8_rom_info_t* info = chip8_rom_lookup(image.data, image.size);
+	chip8_platform_t platform = info ? info->platform : image.size > CHIP8_MAX_ROM_SIZE ? CHIP8_PLATFORM_XOCHIP : CHIP8_PLATFORM_CHIP8;
+	if (override.platform >= 0)
+		platform = override.platform;
+	int cycles_per_frame = info ? info->cycles_per_frame : CHIP8_DEFAULT_CYCLES_PER_FRAME;
+	if (override.cycles_per_frame > 0)
+		cycles_per_frame = override.cycles_per_frame;
+	int idle_pc = info && info->idle_pc ? info->idle_pc : -1;
+	if (info)
+		fprintf(capture_file ? stderr : stdout, "Recognized %s\n", info->title);
+
 	chip8_t cpu;
 
-	init_cpu(&cpu);
-	load_rom(&cpu, rom);
+	if (chip8_init(&cpu, platform) < 0)
+	{
+		chip8_rom_unmap(&image);
+		return -1;
+	}
+	if (info && info->platform == platform)
+		chip8_set_quirks(&cpu, info->quirks);
+	if (override.quirks >= 0)
+		chip8_set_quirks(&cpu, override.quirks);
+	chip8_set_idle_pc(&cpu, idle_pc);
+	chip8_set_cycles_per_frame(&cpu, cycles_per_frame);
+	if (chip8_load_rom_mem(&cpu, image.data, image.size) < 0)
+	{
+		chip8_rom_unmap(&image);
+		free_cpu(&cpu);
+		return -1;
+	}
+	chip8_rom_unmap(&image);
 
-	if (!SDL_Init(SDL_INIT_VIDEO))
+	// Trace and capture output both go through one batched sink
+	static sink_t sink;
+	static trace_t tracer;
+	trace_t* trace = NULL;
+	int sink_started = capture_file || trace_file;
+	if (sink_started && sink_init(&sink) < 0)
+	{
+		free_cpu(&cpu);
+		return -1;
+	}
+	if (trace_file)
+	{
+		if (trace_open(&tracer, &sink, trace_file, &cpu) < 0)
+		{
+			sink_quit(&sink);
+			free_cpu(&cpu);
+			return -1;
+		}
+		trace = &tracer;
+	}
+
+	if (capture_file)
+	{
+		// Headless: status goes to stderr since the stream may be stdout
+		static capture_t capture;
+		int result = capture_open(&capture, &sink, capture_file, capture_format, capture_dedup);
+		if (result > 0)
+		{
+			run_headless(&cpu, frame_count, &capture, trace);
+			capture_close(&capture);
+			fprintf(stderr, "Captured %llu frames\n", (unsigned long long)capture.written);
+		}
+		if (trace)
+			trace_close(trace);
+		sink_quit(&sink);
+		free_cpu(&cpu);
+		return result;
+	}
+
+	if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO))
 	{
 		SDL_Log("SDL_Init Failed!");
+		if (trace)
+			trace_close(trace);
+		if (sink_started)
+			sink_quit(&sink);
+		free_cpu(&cpu);
 		return -1;
 	}
 
@@ -34,59 +461,156 @@ int main(int argc, char const* argv[])
 		SDL_Quit();
 	}
 
-	SDL_Renderer *renderer = SDL_CreateRenderer(window, NULL);
-	if (!renderer)
+	// The debugger overlay is drawn with SDL_Renderer, so debugging keeps
+	// to that path
+	static gpu_t gpu;
+	if (use_gpu && (debugging || gpu_init(&gpu, window, palette, phosphor, scanlines) < 0))
+		use_gpu = 0;
+
+	SDL_Renderer* renderer = NULL;
+	SDL_Texture* texture = NULL;
+	if (!use_gpu)
+	{
+		renderer = SDL_CreateRenderer(window, NULL);
+		if (!renderer)
+		{
+			printf("SDL_CreateRenderer Error: %s\n", SDL_GetError());
+			SDL_DestroyWindow(window);
+			SDL_Quit();
+		}
+	}
+
+	// Runs without sound if there's no audio device
+	static audio_t audio;
+	if (audio_init(&audio) < 0 && audio_paced)
+	{
+		printf("No audio device, pacing with the system timer instead\n");
+		audio_paced = 0;
+	}
+
+	video_init();
+	if (!use_gpu)
+	{
+		SDL_SetRenderVSync(renderer, 1);
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING, CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+	}
+	if (!use_gpu && !texture)
 	{
-		printf("SDL_CreateRenderer Error: %s\n", SDL_GetError());
+		printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+		if (trace)
+			trace_close(trace);
+		if (sink_started)
+			sink_quit(&sink);
+		audio_quit(&audio);
+		SDL_DestroyRenderer(renderer);
 		SDL_DestroyWindow(window);
 		SDL_Quit();
+		free_cpu(&cpu);
+		return -1;
 	}
+	if (texture)
+		SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
 
-	SDL_Event event;
+	static frame_buffer_t frames;
+	frame_buffer_init(&frames);
 
-	int running = 1;
+	emulator_t emu = { &cpu, &audio, &frames, trace, NULL, audio_paced, { 0 }, { 0 } };
+	SDL_SetAtomicInt(&emu.running, 1);
 
-	while (running)
-	{ 
-		emulate_cycle(&cpu); 
+	static debug_t debug;
+	if (debugging && debug_init(&debug, &cpu, &emu.running) > 0)
+		emu.debug = &debug;
+
+	SDL_Thread* thread = SDL_CreateThread(emulation_thread, "chip8 emulation", &emu);
+	if (!thread)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		SDL_SetAtomicInt(&emu.running, 0);
+	}
 
-		if (cpu.draw_flag)
+	SDL_Event event;
+	int presented = 0;
+	int width = CHIP8_LORES_WIDTH;
+	int height = CHIP8_LORES_HEIGHT;
+
+	// With more than one frame of persistence, the history is stepped at
+	// 60 Hz even when nothing new arrives so that trails still run out
+	static persist_t persist;
+	persist_init(&persist, persist_frames);
+	Uint64 last_step = 0;
+
+	// The main thread only handles events and presents the newest frame;
+	// with vsync on, presenting paces it to the display refresh
+	while (SDL_GetAtomicInt(&emu.running))
+	{
+		if (SDL_WaitEventTimeout(&event, 1))
 		{
-			SDL_Delay(2);
-			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-			SDL_RenderClear(renderer);
-			SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-			for (int y = 0; y < CHIP8_HEIGHT; y++)
+			do
 			{
-				for (int x = 0; x < CHIP8_WIDTH; x++)
+				if (event.type == SDL_EVENT_QUIT)
 				{
-					if (cpu.display[y * CHIP8_WIDTH + x])
-					{
-						SDL_FRect rect = { x * PIXEL_SIZE, y * PIXEL_SIZE, PIXEL_SIZE, PIXEL_SIZE };
-						SDL_RenderFillRect(renderer, &rect);
-					}
+					SDL_SetAtomicInt(&emu.running, 0);
 				}
-			}
-
-			SDL_RenderPresent(renderer);
-			cpu.draw_flag = 0; 
+				else if ((event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP) && !event.key.repeat)
+				{
+					// Only this thread writes the mask, so a plain read-modify-write is safe
+					SDL_SetAtomicInt(&emu.keys, update_keys(SDL_GetAtomicInt(&emu.keys), &event.key));
+				}
+			} while (SDL_PollEvent(&event));
 		}
 
-		while (SDL_PollEvent(&event))
+		// Until something has been shown, every row counts as changed
+		uint64_t changed;
+		const frame_t* frame = frame_buffer_acquire(&frames, &changed);
+		if (persist.frames > 1)
 		{
-			if (event.type == SDL_EVENT_QUIT)
+			Uint64 now = SDL_GetTicksNS();
+			if (frame || (presented && persist.recent && now - last_step >= FRAME_NS))
 			{
-				running = 0;
+				frame = persist_push(&persist, frame, &changed);
+				last_step = now;
 			}
 		}
+		if (frame)
+		{
+			if (use_gpu)
+				gpu_upload(&gpu, frame, presented ? changed : CHIP8_ALL_ROWS);
+			else
+				upload_frame(texture, frame, presented ? changed : CHIP8_ALL_ROWS);
+			width = frame->width;
+			height = frame->height;
+			presented = 1;
+		}
 
-		//SDL_SetRenderDrawColor(renderer, 0, 128, 255, 255);
-		//SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-		//SDL_RenderClear(renderer);
-		//SDL_RenderPresent(renderer); // present the frame
+		// The overlay changes while the display doesn't, and so do fading
+		// phosphor trails, so keep presenting for those
+		if (use_gpu && (frame || (gpu.phosphor > 0 && presented)))
+		{
+			SDL_FRect dst = screen_rect(width, height);
+			gpu_present(&gpu, &dst);
+		}
+		else if (!use_gpu && (frame || (emu.debug && presented)))
+			present(renderer, texture, width, height, emu.debug);
+	}
+
+	SDL_WaitThread(thread, NULL);
+	if (emu.debug)
+		debug_quit(emu.debug, &cpu);
+	if (trace)
+	{
+		trace_close(trace);
+		printf("Traced %llu instructions\n", (unsigned long long)trace->instructions);
 	}
+	if (sink_started)
+		sink_quit(&sink);
 
+	if (use_gpu)
+		gpu_quit(&gpu);
+	else
+		SDL_DestroyTexture(texture);
+	audio_quit(&audio);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
+	free_cpu(&cpu);
 	return 1;
 }
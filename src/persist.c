@@ -0,0 +1,110 @@
+#include <string.h>
+#include "persist.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PERSIST_SSE2 1
+#endif
+
+void persist_init(persist_t* persist, int frames)
+{
+	memset(persist, 0, sizeof(*persist));
+	if (frames < 1)
+		frames = 1;
+	if (frames > PERSIST_MAX_FRAMES)
+		frames = PERSIST_MAX_FRAMES;
+	persist->frames = frames;
+	persist->out.width = CHIP8_LORES_WIDTH;
+	persist->out.height = CHIP8_LORES_HEIGHT;
+}
+
+// Stores the newest frame's row y (plane 0 words in cur0, plane 1 in cur1)
+// into the head slot and ORs it with the rest of the history into the
+// output. Returns nonzero if the output row changed.
+static int combine_row(persist_t* persist, int y, const uint64_t* cur0, const uint64_t* cur1)
+{
+	uint64_t* out0 = persist->out.display[0][y];
+	uint64_t* out1 = persist->out.display[1][y];
+#ifdef PERSIST_SSE2
+	__m128i p0 = _mm_loadu_si128((const __m128i*)cur0);
+	__m128i p1 = _mm_loadu_si128((const __m128i*)cur1);
+	__m128i* slot = (__m128i*)persist->history[persist->head][y];
+	_mm_storeu_si128(slot, p0);
+	_mm_storeu_si128(slot + 1, p1);
+	for (int s = 0; s < persist->frames; s++)
+	{
+		const __m128i* row = (const __m128i*)persist->history[s][y];
+		p0 = _mm_or_si128(p0, _mm_loadu_si128(row));
+		p1 = _mm_or_si128(p1, _mm_loadu_si128(row + 1));
+	}
+
+	__m128i same = _mm_and_si128(_mm_cmpeq_epi32(p0, _mm_loadu_si128((const __m128i*)out0)),
+		_mm_cmpeq_epi32(p1, _mm_loadu_si128((const __m128i*)out1)));
+	if (_mm_movemask_epi8(same) == 0xFFFF)
+		return 0;
+	_mm_storeu_si128((__m128i*)out0, p0);
+	_mm_storeu_si128((__m128i*)out1, p1);
+	return 1;
+#else
+	uint64_t p[4] = { cur0[0], cur0[1], cur1[0], cur1[1] };
+	memcpy(persist->history[persist->head][y], p, sizeof(p));
+	for (int s = 0; s < persist->frames; s++)
+	{
+		const uint64_t* row = persist->history[s][y];
+		p[0] |= row[0];
+		p[1] |= row[1];
+		p[2] |= row[2];
+		p[3] |= row[3];
+	}
+
+	if (out0[0] == p[0] && out0[1] == p[1] && out1[0] == p[2] && out1[1] == p[3])
+		return 0;
+	out0[0] = p[0];
+	out0[1] = p[1];
+	out1[0] = p[2];
+	out1[1] = p[3];
+	return 1;
+#endif
+}
+
+// Takes the next frame, or NULL to repeat the newest one so that trails run
+// out when a program stops drawing. On entry changed holds the rows that
+// differ from the previous frame; on return, the rows of the returned frame
+// that differ from the previous output.
+//
+// A row is the same in all of the last K frames unless it changed in one of
+// them, so only the rows in recent need their history slot refreshed and
+// their output recombined; everything else is untouched.
+const frame_t* persist_push(persist_t* persist, const frame_t* frame, uint64_t* changed)
+{
+	int prev = persist->head;
+	int head = (prev + 1) % persist->frames;
+	persist->head = head;
+	persist->changed[head] = frame ? *changed : 0;
+
+	uint64_t recent = 0;
+	for (int s = 0; s < persist->frames; s++)
+		recent |= persist->changed[s];
+	persist->recent = recent;
+
+	if (frame)
+	{
+		persist->out.width = frame->width;
+		persist->out.height = frame->height;
+	}
+
+	uint64_t out = 0;
+	for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+	{
+		if (!((recent >> y) & 1))
+			continue;
+
+		// Repeating a frame means taking the rows from the previous slot
+		const uint64_t* cur0 = frame ? frame->display[0][y] : persist->history[prev][y];
+		const uint64_t* cur1 = frame ? frame->display[1][y] : persist->history[prev][y] + 2;
+		if (combine_row(persist, y, cur0, cur1))
+			out |= 1ull << y;
+	}
+	*changed = out;
+	return &persist->out;
+}
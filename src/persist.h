@@ -0,0 +1,26 @@
+#ifndef _PERSIST_H
+#define _PERSIST_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "frame.h"
+
+#define PERSIST_MAX_FRAMES 8
+
+// Anti-flicker: shows each pixel lit if it was lit in any of the last K
+// frames, so sprites that are erased and redrawn by XOR every frame stay
+// solid. The history is kept row by row and only rows that changed within
+// the last K frames are recombined, which on a typical game is a handful of
+// 128-bit ORs per frame.
+typedef struct {
+	int frames; // K, 1 turns the stage into a pass-through
+	int head; // history slot holding the newest frame
+	// Both planes of a row side by side: plane 0 words, then plane 1 words
+	uint64_t history[PERSIST_MAX_FRAMES][CHIP8_HIRES_HEIGHT][4];
+	uint64_t changed[PERSIST_MAX_FRAMES]; // rows that changed going into each slot's frame
+	uint64_t recent; // rows that changed in any of the last K frames
+	frame_t out;
+} persist_t;
+
+void persist_init(persist_t* persist, int frames);
+const frame_t* persist_push(persist_t* persist, const frame_t* frame, uint64_t* changed);
+#endif
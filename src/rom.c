@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "rom.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int chip8_rom_map(chip8_rom_t* rom, const char* filename)
+{
+	rom->data = NULL;
+	rom->size = 0;
+	rom->handle = NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		printf("File not found: %s\n", filename);
+		return -1;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return -1;
+	}
+
+	if (size.QuadPart == 0) // empty files can't be mapped, but they're still valid
+	{
+		CloseHandle(file);
+		return 1;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file); // the mapping keeps its own reference
+	if (!mapping)
+	{
+		printf("Could not map %s\n", filename);
+		return -1;
+	}
+
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		printf("Could not map %s\n", filename);
+		CloseHandle(mapping);
+		return -1;
+	}
+
+	rom->data = view;
+	rom->size = (size_t)size.QuadPart;
+	rom->handle = mapping;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("File not found: %s\n", filename);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return 1;
+	}
+
+	void* view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping stays valid after the descriptor is closed
+	if (view == MAP_FAILED)
+	{
+		printf("Could not map %s\n", filename);
+		return -1;
+	}
+
+	rom->data = view;
+	rom->size = (size_t)st.st_size;
+#endif
+	return 1;
+}
+
+void chip8_rom_unmap(chip8_rom_t* rom)
+{
+	if (!rom->data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(rom->data);
+	CloseHandle(rom->handle);
+#else
+	munmap((void*)rom->data, rom->size);
+#endif
+	rom->data = NULL;
+	rom->size = 0;
+	rom->handle = NULL;
+}
+
+static uint32_t rol32(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t block[64])
+{
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++)
+		w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	for (int i = 16; i < 80; i++)
+		w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int i = 0; i < 80; i++)
+	{
+		uint32_t f, k;
+		if (i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		uint32_t t = rol32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol32(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void chip8_sha1(const uint8_t* data, size_t len, uint8_t digest[CHIP8_SHA1_SIZE])
+{
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	uint64_t bits = (uint64_t)len * 8;
+
+	size_t full = len & ~(size_t)63;
+	for (size_t i = 0; i < full; i += 64)
+		sha1_block(state, data + i);
+
+	// The tail, the 0x80 terminator and the bit length take one or two more blocks
+	uint8_t tail[128] = { 0 };
+	size_t rest = len - full;
+	if (rest)
+		memcpy(tail, data + full, rest);
+	tail[rest] = 0x80;
+
+	size_t tail_len = rest < 56 ? 64 : 128;
+	for (int i = 0; i < 8; i++)
+		tail[tail_len - 1 - i] = (uint8_t)(bits >> (i * 8));
+
+	for (size_t i = 0; i < tail_len; i += 64)
+		sha1_block(state, tail + i);
+
+	for (int i = 0; i < 5; i++)
+	{
+		digest[i * 4] = (uint8_t)(state[i] >> 24);
+		digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+		digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+		digest[i * 4 + 3] = (uint8_t)state[i];
+	}
+}
+
+// Settings for ROMs whose hash has been checked against a file in this tree.
+// That's only the bundled IBM logo for now; anything else runs on the
+// defaults unless the command line says otherwise. Kept sorted by hash so
+// it can be binary searched.
+static const chip8_rom_info_t rom_db[] = {
+	{ // bin/ibm-logo.ch8; draws once and then spins on 1228
+		{ 0xb9, 0xbb, 0xc1, 0x2c, 0xee, 0x3f, 0x7b, 0x9d, 0x3b, 0x1f,
+		  0x69, 0x16, 0x1f, 0x7d, 0x7a, 0x2d, 0x86, 0x95, 0x33, 0x79 },
+		CHIP8_PLATFORM_CHIP8,
+		CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_MEM_INC_I | CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_CLIP,
+		11, 0x228, "IBM Logo"
+	},
+};
+
+static int compare_info(const void* key, const void* entry)
+{
+	return memcmp(key, ((const chip8_rom_info_t*)entry)->sha1, CHIP8_SHA1_SIZE);
+}
+
+const chip8_rom_info_t* chip8_rom_lookup(const uint8_t* data, size_t len)
+{
+	uint8_t digest[CHIP8_SHA1_SIZE];
+	chip8_sha1(data, len, digest);
+	return bsearch(digest, rom_db, sizeof(rom_db) / sizeof(rom_db[0]), sizeof(rom_db[0]), compare_info);
+}
@@ -0,0 +1,39 @@
+#ifndef _ROM_H
+#define _ROM_H
+#include <stddef.h>
+#include <stdint.h>
+
+// A read-only view of a ROM file. The bytes are mapped straight from the
+// file so one mapping can be shared by any number of chip8_t instances,
+// each of which copies it in with chip8_load_rom_mem().
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	void* handle; // platform mapping handle, NULL on POSIX
+} chip8_rom_t;
+
+#define CHIP8_SHA1_SIZE 20
+
+// What's known about a ROM, looked up by the SHA-1 of its bytes
+typedef struct {
+	uint8_t sha1[CHIP8_SHA1_SIZE];
+	uint8_t platform; // chip8_platform_t
+	uint8_t quirks; // CHIP8_QUIRK_* flags
+	uint16_t cycles_per_frame;
+	uint16_t idle_pc; // the ROM parks here waiting on a timer or key, 0 if unknown
+	const char* title;
+} chip8_rom_info_t;
+
+// Settings given on the command line, which win over chip8_rom_lookup();
+// -1 where not given
+typedef struct {
+	int platform; // chip8_platform_t
+	int quirks; // CHIP8_QUIRK_* flags
+	int cycles_per_frame;
+} chip8_rom_override_t;
+
+int chip8_rom_map(chip8_rom_t* rom, const char* filename);
+void chip8_rom_unmap(chip8_rom_t* rom);
+void chip8_sha1(const uint8_t* data, size_t len, uint8_t digest[CHIP8_SHA1_SIZE]);
+const chip8_rom_info_t* chip8_rom_lookup(const uint8_t* data, size_t len);
+#endif
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "sink.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define SINK_IOV_MAX 64
+
+struct iovec {
+	void* iov_base;
+	size_t iov_len;
+};
+
+// Windows has no gather write for plain file descriptors
+static long long write_vector(int fd, const struct iovec* iov, int count)
+{
+	long long total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int n = _write(fd, iov[i].iov_base, (unsigned int)iov[i].iov_len);
+		if (n < 0)
+			return total ? total : -1;
+		total += n;
+		if ((size_t)n < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+static int open_file(const char* filename)
+{
+	return _open(filename, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+}
+#else
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define SINK_IOV_MAX 1024
+
+static long long write_vector(int fd, const struct iovec* iov, int count)
+{
+	ssize_t n;
+	do
+		n = writev(fd, iov, count);
+	while (n < 0 && errno == EINTR);
+	return n;
+}
+
+static int open_file(const char* filename)
+{
+	return open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+#endif
+
+// Writes every block in order, retrying partial writes from where they stopped
+static void write_blocks(sink_stream_t* stream, sink_block_t** blocks, int count)
+{
+	struct iovec iov[SINK_IOV_MAX];
+
+	for (int i = 0; i < count; i++)
+	{
+		iov[i].iov_base = blocks[i]->data;
+		iov[i].iov_len = blocks[i]->used;
+	}
+
+	struct iovec* next = iov;
+	while (count > 0 && !stream->failed)
+	{
+		long long n = write_vector(stream->fd, next, count);
+		if (n < 0)
+		{
+			printf("Sink write failed on fd %d\n", stream->fd);
+			stream->failed = 1;
+			break;
+		}
+
+		while (count > 0 && (size_t)n >= next->iov_len)
+		{
+			n -= next->iov_len;
+			next++;
+			count--;
+		}
+		if (count > 0)
+		{
+			next->iov_base = (uint8_t*)next->iov_base + n;
+			next->iov_len -= n;
+		}
+	}
+}
+
+// Writes one batch taken off the queue. Blocks of the same stream are
+// gathered, in order, into as few writev() calls as possible.
+static void write_batch(sink_block_t* batch)
+{
+	sink_block_t* gathered[SINK_IOV_MAX];
+
+	for (sink_block_t* first = batch; first; first = first->next)
+	{
+		sink_stream_t* stream = first->stream;
+		if (!stream) // already written as part of an earlier group
+			continue;
+
+		int count = 0;
+		int last = 0;
+		for (sink_block_t* block = first; block; block = block->next)
+		{
+			if (block->stream != stream)
+				continue;
+
+			gathered[count++] = block;
+			last |= block->last;
+			block->stream = NULL;
+			if (count == SINK_IOV_MAX)
+			{
+				write_blocks(stream, gathered, count);
+				count = 0;
+			}
+		}
+		if (count)
+			write_blocks(stream, gathered, count);
+
+		if (last)
+		{
+			if (stream->fd != 1)
+#ifdef _WIN32
+				_close(stream->fd);
+#else
+				close(stream->fd);
+#endif
+			free(stream);
+		}
+	}
+}
+
+static int SDLCALL sink_thread(void* data)
+{
+	sink_t* sink = data;
+
+	for (;;)
+	{
+		SDL_LockMutex(sink->lock);
+		while (!sink->queue_head && !sink->quit)
+			SDL_WaitCondition(sink->ready, sink->lock);
+		sink_block_t* batch = sink->queue_head;
+		sink->queue_head = NULL;
+		sink->queue_tail = NULL;
+		SDL_UnlockMutex(sink->lock);
+
+		if (!batch) // quitting with nothing left to write
+			break;
+
+		write_batch(batch);
+
+		int returned = 0;
+		sink_block_t* tail = batch;
+		for (;; tail = tail->next)
+		{
+			returned++;
+			if (!tail->next)
+				break;
+		}
+
+		SDL_LockMutex(sink->lock);
+		tail->next = sink->free_list;
+		sink->free_list = batch;
+		SDL_UnlockMutex(sink->lock);
+		for (int i = 0; i < returned; i++)
+			SDL_SignalSemaphore(sink->available);
+	}
+
+	return 0;
+}
+
+int sink_init(sink_t* sink)
+{
+	memset(sink, 0, sizeof(*sink));
+
+	sink->blocks = malloc(SINK_BLOCKS * sizeof(sink_block_t));
+	if (!sink->blocks)
+	{
+		printf("Failed to allocate sink buffers\n");
+		return -1;
+	}
+	for (int i = 0; i < SINK_BLOCKS; i++)
+	{
+		sink->blocks[i].next = i + 1 < SINK_BLOCKS ? &sink->blocks[i + 1] : NULL;
+	}
+	sink->free_list = sink->blocks;
+
+	sink->lock = SDL_CreateMutex();
+	sink->ready = SDL_CreateCondition();
+	sink->available = SDL_CreateSemaphore(SINK_BLOCKS);
+	if (!sink->lock || !sink->ready || !sink->available)
+	{
+		printf("Sink Error: %s\n", SDL_GetError());
+		goto fail;
+	}
+
+	sink->thread = SDL_CreateThread(sink_thread, "chip8 sink", sink);
+	if (!sink->thread)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		goto fail;
+	}
+	return 1;
+
+fail:
+	SDL_DestroySemaphore(sink->available);
+	SDL_DestroyCondition(sink->ready);
+	SDL_DestroyMutex(sink->lock);
+	free(sink->blocks);
+	return -1;
+}
+
+// Opens filename for writing, or stdout for "-"
+sink_stream_t* sink_open(sink_t* sink, const char* filename)
+{
+	sink_stream_t* stream = calloc(1, sizeof(sink_stream_t));
+	if (!stream)
+		return NULL;
+
+	if (strcmp(filename, "-") == 0)
+	{
+#ifdef _WIN32
+		_setmode(1, _O_BINARY);
+#endif
+		stream->fd = 1;
+	}
+	else
+	{
+		stream->fd = open_file(filename);
+		if (stream->fd < 0)
+		{
+			printf("Failed to open %s\n", filename);
+			free(stream);
+			return NULL;
+		}
+	}
+
+	stream->sink = sink;
+	return stream;
+}
+
+static void submit(sink_stream_t* stream, int last)
+{
+	sink_t* sink = stream->sink;
+	sink_block_t* block = stream->block;
+
+	block->stream = stream;
+	block->last = last;
+	block->next = NULL;
+	stream->block = NULL;
+
+	SDL_LockMutex(sink->lock);
+	if (sink->queue_tail)
+		sink->queue_tail->next = block;
+	else
+		sink->queue_head = block;
+	sink->queue_tail = block;
+	SDL_UnlockMutex(sink->lock);
+	SDL_SignalCondition(sink->ready);
+}
+
+static void take_block(sink_stream_t* stream)
+{
+	sink_t* sink = stream->sink;
+
+	SDL_WaitSemaphore(sink->available); // only blocks once the whole pool is queued
+	SDL_LockMutex(sink->lock);
+	stream->block = sink->free_list;
+	sink->free_list = stream->block->next;
+	SDL_UnlockMutex(sink->lock);
+	stream->block->used = 0;
+}
+
+void sink_write(sink_stream_t* stream, const void* data, size_t len)
+{
+	const uint8_t* bytes = data;
+
+	while (len > 0)
+	{
+		if (!stream->block)
+			take_block(stream);
+
+		sink_block_t* block = stream->block;
+		size_t n = SINK_BLOCK_SIZE - block->used;
+		if (n > len)
+			n = len;
+		memcpy(block->data + block->used, bytes, n);
+		block->used += n;
+		bytes += n;
+		len -= n;
+
+		if (block->used == SINK_BLOCK_SIZE)
+			submit(stream, 0);
+	}
+}
+
+// Queues whatever has been written so far without waiting for a full block
+void sink_flush(sink_stream_t* stream)
+{
+	if (stream->block && stream->block->used)
+		submit(stream, 0);
+}
+
+// Queues the remaining data; the I/O thread closes and frees the stream
+// after writing it
+void sink_close(sink_stream_t* stream)
+{
+	if (!stream->block)
+		take_block(stream);
+	submit(stream, 1);
+}
+
+// Writes out everything queued, then stops the I/O thread
+void sink_quit(sink_t* sink)
+{
+	SDL_LockMutex(sink->lock);
+	sink->quit = 1;
+	SDL_UnlockMutex(sink->lock);
+	SDL_SignalCondition(sink->ready);
+	SDL_WaitThread(sink->thread, NULL);
+
+	SDL_DestroySemaphore(sink->available);
+	SDL_DestroyCondition(sink->ready);
+	SDL_DestroyMutex(sink->lock);
+	free(sink->blocks);
+}
@@ -0,0 +1,53 @@
+#ifndef _SINK_H
+#define _SINK_H
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/SDL3/SDL.h"
+
+#define SINK_BLOCK_SIZE (64 * 1024)
+#define SINK_BLOCKS 256 // 16 MB in flight across every stream
+
+typedef struct sink sink_t;
+typedef struct sink_stream sink_stream_t;
+
+typedef struct sink_block {
+	struct sink_block* next;
+	sink_stream_t* stream;
+	size_t used;
+	int last; // bool: the stream is closed once this block is written
+	uint8_t data[SINK_BLOCK_SIZE];
+} sink_block_t;
+
+// One output file. A stream must only be written by one thread at a time;
+// different streams can be written concurrently.
+struct sink_stream {
+	sink_t* sink;
+	int fd;
+	int failed; // bool, I/O thread only
+	sink_block_t* block; // block being filled, producer only
+};
+
+// Batched output for many streams. Producers append into large blocks
+// without any locking; full blocks are queued for a single I/O thread that
+// takes the whole queue at once and writes each stream's blocks with one
+// writev() call. The block pool is bounded, so a producer only waits when
+// the disk is that far behind.
+struct sink {
+	SDL_Mutex* lock;
+	SDL_Condition* ready; // signalled when blocks are queued or on quit
+	SDL_Semaphore* available; // blocks in the free list
+	sink_block_t* blocks; // backing store for the pool
+	sink_block_t* free_list; // under lock
+	sink_block_t* queue_head; // under lock
+	sink_block_t* queue_tail;
+	int quit; // under lock
+	SDL_Thread* thread;
+};
+
+int sink_init(sink_t* sink);
+sink_stream_t* sink_open(sink_t* sink, const char* filename);
+void sink_write(sink_stream_t* stream, const void* data, size_t len);
+void sink_flush(sink_stream_t* stream);
+void sink_close(sink_stream_t* stream);
+void sink_quit(sink_t* sink);
+#endif
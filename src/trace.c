@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+#include "trace.h"
+
+static uint8_t* put_varint(uint8_t* p, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static uint32_t zigzag(int16_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 15);
+}
+
+static void put32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+// Bytes an instruction stores to memory, all starting at the I it ran with
+static int stored_bytes(const chip8_t* cpu, uint16_t opcode)
+{
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+
+	if ((opcode & 0xF0FF) == 0xF033)
+		return 3;
+	if ((opcode & 0xF0FF) == 0xF055)
+		return x + 1;
+	if ((opcode & 0xF00F) == 0x5002 && cpu->platform == CHIP8_PLATFORM_XOCHIP)
+		return (x > y ? x - y : y - x) + 1;
+	return 0;
+}
+
+static int SDLCALL trace_thread(void* data)
+{
+	trace_t* trace = data;
+	uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+
+	for (;;)
+	{
+		SDL_WaitSemaphore(trace->full);
+		if (SDL_GetAtomicInt(&trace->done) && trace->tail == trace->head) // head is final once done is set
+			break;
+
+		trace_block_t* block = &trace->pool[trace->tail & (TRACE_POOL - 1)];
+		size_t packed = lz_compress(block->data, block->used, trace->packed);
+		const uint8_t* payload = trace->packed;
+		if (packed >= block->used) // incompressible, store it as is
+		{
+			packed = block->used;
+			payload = block->data;
+		}
+
+		put32(header, (uint32_t)block->used);
+		put32(header + 4, (uint32_t)packed);
+		put32(header + 8, block->count);
+		header[12] = (uint8_t)block->pc;
+		header[13] = (uint8_t)(block->pc >> 8);
+		header[14] = (uint8_t)block->ir;
+		header[15] = (uint8_t)(block->ir >> 8);
+		sink_write(trace->out, header, sizeof(header));
+		sink_write(trace->out, payload, packed);
+
+		trace->tail++;
+		SDL_SignalSemaphore(trace->free);
+	}
+
+	return 0;
+}
+
+int trace_open(trace_t* trace, sink_t* sink, const char* filename, const chip8_t* cpu)
+{
+	memset(trace, 0, sizeof(*trace));
+
+	for (int i = 0; i < TRACE_POOL; i++)
+	{
+		trace->pool[i].data = malloc(TRACE_BLOCK_SIZE);
+		if (!trace->pool[i].data)
+			goto fail;
+	}
+	trace->packed = malloc(LZ_BOUND(TRACE_BLOCK_SIZE));
+	if (!trace->packed)
+		goto fail;
+
+	trace->free = SDL_CreateSemaphore(TRACE_POOL - 1); // one block is always being filled
+	trace->full = SDL_CreateSemaphore(0);
+	if (!trace->free || !trace->full)
+	{
+		printf("SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+		goto fail;
+	}
+
+	trace->out = sink_open(sink, filename);
+	if (!trace->out)
+		goto fail;
+
+	uint8_t header[TRACE_HEADER_SIZE] = { 0 };
+	memcpy(header, TRACE_MAGIC, 4);
+	header[4] = TRACE_VERSION;
+	header[5] = cpu->platform;
+	sink_write(trace->out, header, sizeof(header));
+
+	trace->thread = SDL_CreateThread(trace_thread, "chip8 trace", trace);
+	if (!trace->thread)
+	{
+		printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+		sink_close(trace->out);
+		goto fail;
+	}
+	return 1;
+
+fail:
+	printf("Failed to start tracing\n");
+	SDL_DestroySemaphore(trace->free);
+	SDL_DestroySemaphore(trace->full);
+	for (int i = 0; i < TRACE_POOL; i++)
+		free(trace->pool[i].data);
+	free(trace->packed);
+	return -1;
+}
+
+static void submit(trace_t* trace)
+{
+	trace->head++;
+	SDL_SignalSemaphore(trace->full);
+	SDL_WaitSemaphore(trace->free); // only blocks once every block is queued
+}
+
+// Executes one instruction and records what it did. A halted or waiting CPU
+// executes nothing, so nothing is recorded.
+void trace_step(trace_t* trace, chip8_t* cpu)
+{
+	if (cpu->halted || cpu->waiting)
+		return;
+
+	uint16_t pc = cpu->pc;
+	uint16_t ir = cpu->ir;
+	uint16_t opcode = chip8_read(cpu, pc) << 8 | chip8_read(cpu, pc + 1);
+	uint8_t V[16];
+	memcpy(V, cpu->V, sizeof(V));
+
+	emulate_cycle(cpu);
+
+	trace_block_t* block = &trace->pool[trace->head & (TRACE_POOL - 1)];
+	if (block->used + TRACE_MAX_RECORD > TRACE_BLOCK_SIZE)
+	{
+		submit(trace);
+		block = &trace->pool[trace->head & (TRACE_POOL - 1)];
+		block->used = 0;
+		block->count = 0;
+	}
+	if (block->count == 0)
+	{
+		block->pc = pc;
+		block->ir = ir;
+	}
+
+	uint8_t* record = block->data + block->used;
+	uint8_t* p = record + 3;
+	uint8_t flags = 0;
+	record[1] = (uint8_t)(opcode >> 8);
+	record[2] = (uint8_t)opcode;
+
+	int16_t jump = (int16_t)(cpu->pc - (uint16_t)(pc + 2));
+	if (jump)
+	{
+		flags |= TRACE_JUMP;
+		p = put_varint(p, zigzag(jump));
+	}
+	if (cpu->ir != ir)
+	{
+		flags |= TRACE_I;
+		p = put_varint(p, zigzag((int16_t)(cpu->ir - ir)));
+	}
+
+	uint16_t regs = 0;
+	for (int i = 0; i < 16; i++)
+		regs |= (uint16_t)(cpu->V[i] != V[i]) << i;
+	if (regs && !(regs & (regs - 1)))
+	{
+		int reg = 0;
+		while (!((regs >> reg) & 1))
+			reg++;
+		flags |= TRACE_REG;
+		*p++ = (uint8_t)reg;
+		*p++ = cpu->V[reg];
+	}
+	else if (regs)
+	{
+		flags |= TRACE_REGS;
+		*p++ = (uint8_t)regs;
+		*p++ = (uint8_t)(regs >> 8);
+		for (int i = 0; i < 16; i++)
+		{
+			if ((regs >> i) & 1)
+				*p++ = cpu->V[i];
+		}
+	}
+
+	int stored = stored_bytes(cpu, opcode);
+	if (stored)
+	{
+		flags |= TRACE_MEM;
+		p = put_varint(p, 0); // offset from the old I, where every store starts
+		*p++ = (uint8_t)stored;
+		for (int i = 0; i < stored; i++)
+			*p++ = chip8_read(cpu, ir + i);
+	}
+
+	record[0] = flags;
+	block->used = p - block->data;
+	block->count++;
+	trace->instructions++;
+}
+
+// Flushes the partial block, waits for the compressor and closes the stream
+void trace_close(trace_t* trace)
+{
+	trace_block_t* block = &trace->pool[trace->head & (TRACE_POOL - 1)];
+	if (block->count)
+	{
+		trace->head++;
+		SDL_SignalSemaphore(trace->full);
+	}
+	SDL_SetAtomicInt(&trace->done, 1);
+	SDL_SignalSemaphore(trace->full);
+	SDL_WaitThread(trace->thread, NULL);
+
+	sink_close(trace->out);
+	SDL_DestroySemaphore(trace->free);
+	SDL_DestroySemaphore(trace->full);
+	for (int i = 0; i < TRACE_POOL; i++)
+		free(trace->pool[i].data);
+	free(trace->packed);
+}
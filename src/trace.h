@@ -0,0 +1,85 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+#include <stdio.h>
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+#include "sink.h"
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_SIZE (1 << 20) // raw bytes of records per compressed block
+#define TRACE_POOL 4 // must be a power of two
+#define TRACE_MAX_RECORD 64
+#define TRACE_MAX_STORE 16 // most bytes one instruction can store (FX55)
+#define TRACE_HEADER_SIZE 8
+#define TRACE_BLOCK_HEADER_SIZE 16
+
+// Record flags. Every record is a flag byte and the big-endian opcode,
+// followed by the fields its flags select, in this order. The PC of each
+// record is the PC the previous one left behind, and each block header
+// carries the state its first record starts from, so blocks decode on
+// their own.
+#define TRACE_JUMP 0x01 // zigzag varint: next PC - (PC + 2)
+#define TRACE_I    0x02 // zigzag varint: new I - old I
+#define TRACE_REG  0x04 // register index, new value
+#define TRACE_REGS 0x08 // 16-bit little-endian register mask, new values
+#define TRACE_MEM  0x10 // zigzag varint: address - old I, byte count, bytes stored
+
+typedef struct {
+	uint8_t* data;
+	size_t used;
+	uint32_t count; // records in data
+	uint16_t pc; // state before the first record
+	uint16_t ir;
+} trace_block_t;
+
+// Records every executed instruction into a compact binary stream. The
+// emulation side only encodes records into raw blocks; a background thread
+// compresses full blocks and hands them to the sink.
+typedef struct {
+	sink_stream_t* out;
+	trace_block_t pool[TRACE_POOL];
+	Uint32 head; // blocks handed to the compressor, emulation side only
+	Uint32 tail; // blocks compressed, compressor only
+	SDL_Semaphore* free;
+	SDL_Semaphore* full;
+	SDL_AtomicInt done;
+	SDL_Thread* thread;
+	uint8_t* packed; // compressor output, LZ_BOUND(TRACE_BLOCK_SIZE) bytes
+	Uint64 instructions;
+} trace_t;
+
+int trace_open(trace_t* trace, sink_t* sink, const char* filename, const chip8_t* cpu);
+void trace_step(trace_t* trace, chip8_t* cpu);
+void trace_close(trace_t* trace);
+
+// One decoded instruction
+typedef struct {
+	Uint64 index;
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t ir; // I after the instruction
+	uint16_t regs; // mask of registers whose value changed
+	uint8_t V[16]; // new values of the registers in regs
+	uint16_t mem_addr;
+	uint8_t mem_count;
+	uint8_t mem[TRACE_MAX_STORE];
+} trace_record_t;
+
+typedef struct {
+	FILE* in;
+	uint8_t platform;
+	uint8_t* raw;
+	uint8_t* packed;
+	size_t size; // bytes in raw
+	size_t pos;
+	uint32_t left; // records left in the current block
+	uint16_t pc;
+	uint16_t ir;
+	Uint64 index;
+} trace_reader_t;
+
+int trace_reader_open(trace_reader_t* reader, const char* filename);
+int trace_reader_next(trace_reader_t* reader, trace_record_t* record);
+void trace_reader_close(trace_reader_t* reader);
+#endif
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+#include "trace.h"
+
+// The reading half of trace.c, kept apart so that offline tools can decode
+// traces without linking the recorder and SDL
+
+static int16_t unzigzag(uint32_t v)
+{
+	return (int16_t)((v >> 1) ^ -(v & 1));
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int trace_reader_open(trace_reader_t* reader, const char* filename)
+{
+	uint8_t header[TRACE_HEADER_SIZE];
+
+	memset(reader, 0, sizeof(*reader));
+	reader->in = fopen(filename, "rb");
+	if (!reader->in)
+	{
+		printf("Failed to open %s\n", filename);
+		return -1;
+	}
+
+	if (fread(header, 1, sizeof(header), reader->in) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4) != 0 || header[4] != TRACE_VERSION)
+	{
+		printf("%s is not a CHIP-8 trace\n", filename);
+		fclose(reader->in);
+		return -1;
+	}
+	reader->platform = header[5];
+
+	reader->raw = malloc(TRACE_BLOCK_SIZE);
+	reader->packed = malloc(LZ_BOUND(TRACE_BLOCK_SIZE));
+	if (!reader->raw || !reader->packed)
+	{
+		trace_reader_close(reader);
+		return -1;
+	}
+	return 1;
+}
+
+static int read_block(trace_reader_t* reader)
+{
+	uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+
+	size_t n = fread(header, 1, sizeof(header), reader->in);
+	if (n == 0)
+		return 0;
+	if (n != sizeof(header))
+		return -1;
+
+	uint32_t raw = get32(header);
+	uint32_t packed = get32(header + 4);
+	if (raw > TRACE_BLOCK_SIZE || packed > raw)
+		return -1;
+
+	uint8_t* dst = packed == raw ? reader->raw : reader->packed;
+	if (fread(dst, 1, packed, reader->in) != packed)
+		return -1;
+	if (packed != raw && lz_decompress(reader->packed, packed, reader->raw, TRACE_BLOCK_SIZE) != (long)raw)
+		return -1;
+
+	reader->size = raw;
+	reader->pos = 0;
+	reader->left = get32(header + 8);
+	reader->pc = header[12] | (header[13] << 8);
+	reader->ir = header[14] | (header[15] << 8);
+	return 1;
+}
+
+static int get_varint(trace_reader_t* reader, uint32_t* v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 21; shift += 7)
+	{
+		if (reader->pos >= reader->size)
+			return -1;
+		uint8_t b = reader->raw[reader->pos++];
+		*v |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return 0;
+	}
+	return -1;
+}
+
+#define NEED(n) do { if (reader->size - reader->pos < (size_t)(n)) return -1; } while (0)
+
+// Decodes the next instruction. Returns 1 on success, 0 at the end of the
+// trace and -1 if the file is truncated or corrupt.
+int trace_reader_next(trace_reader_t* reader, trace_record_t* record)
+{
+	while (reader->left == 0)
+	{
+		int result = read_block(reader);
+		if (result <= 0)
+			return result;
+	}
+
+	NEED(3);
+	const uint8_t* raw = reader->raw;
+	uint8_t flags = raw[reader->pos];
+	uint32_t v;
+
+	record->index = reader->index;
+	record->pc = reader->pc;
+	record->opcode = raw[reader->pos + 1] << 8 | raw[reader->pos + 2];
+	record->regs = 0;
+	record->mem_count = 0;
+	reader->pos += 3;
+
+	int16_t jump = 0;
+	if (flags & TRACE_JUMP)
+	{
+		if (get_varint(reader, &v) < 0)
+			return -1;
+		jump = unzigzag(v);
+	}
+	uint16_t old_ir = reader->ir;
+	if (flags & TRACE_I)
+	{
+		if (get_varint(reader, &v) < 0)
+			return -1;
+		reader->ir = (uint16_t)(reader->ir + unzigzag(v));
+	}
+	if (flags & TRACE_REG)
+	{
+		NEED(2);
+		int reg = raw[reader->pos] & 0xF;
+		record->regs = (uint16_t)(1 << reg);
+		record->V[reg] = raw[reader->pos + 1];
+		reader->pos += 2;
+	}
+	else if (flags & TRACE_REGS)
+	{
+		NEED(2);
+		record->regs = raw[reader->pos] | (raw[reader->pos + 1] << 8);
+		reader->pos += 2;
+		for (int i = 0; i < 16; i++)
+		{
+			if ((record->regs >> i) & 1)
+			{
+				NEED(1);
+				record->V[i] = raw[reader->pos++];
+			}
+		}
+	}
+	if (flags & TRACE_MEM)
+	{
+		if (get_varint(reader, &v) < 0)
+			return -1;
+		NEED(1);
+		record->mem_addr = (uint16_t)(old_ir + unzigzag(v));
+		record->mem_count = raw[reader->pos++];
+		if (record->mem_count > TRACE_MAX_STORE)
+			return -1;
+		NEED(record->mem_count);
+		memcpy(record->mem, raw + reader->pos, record->mem_count);
+		reader->pos += record->mem_count;
+	}
+
+	record->ir = reader->ir;
+	reader->pc = (uint16_t)(reader->pc + 2 + jump);
+	reader->left--;
+	reader->index++;
+	return 1;
+}
+
+void trace_reader_close(trace_reader_t* reader)
+{
+	if (reader->in)
+		fclose(reader->in);
+	free(reader->raw);
+	free(reader->packed);
+}
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "video.h"
+
+typedef void (*expand_row_fn)(const uint64_t* plane0, const uint64_t* plane1, int width, const Uint32 palette[4], Uint32* out);
+
+static void expand_row_scalar(const uint64_t* plane0, const uint64_t* plane1, int width, const Uint32 palette[4], Uint32* out)
+{
+	for (int x = 0; x < width; x++)
+	{
+		int shift = 63 - (x & 63);
+		int color = ((plane0[x >> 6] >> shift) & 1) | (((plane1[x >> 6] >> shift) & 1) << 1);
+		out[x] = palette[color];
+	}
+}
+
+#ifdef SDL_SSE2_INTRINSICS
+// 4 pixels per step: broadcast a nibble of each plane, turn its bits into
+// per-lane masks and use them to select between the four palette entries
+static void SDL_TARGETING("sse2") expand_row_sse2(const uint64_t* plane0, const uint64_t* plane1, int width, const Uint32 palette[4], Uint32* out)
+{
+	const __m128i bits = _mm_set_epi32(1, 2, 4, 8); // lane 0 is the leftmost pixel
+	const __m128i c0 = _mm_set1_epi32((int)palette[0]);
+	const __m128i c1 = _mm_set1_epi32((int)palette[1]);
+	const __m128i c2 = _mm_set1_epi32((int)palette[2]);
+	const __m128i c3 = _mm_set1_epi32((int)palette[3]);
+
+	for (int x = 0; x < width; x += 4)
+	{
+		int shift = 60 - (x & 63);
+		int n0 = (int)((plane0[x >> 6] >> shift) & 0xF);
+		int n1 = (int)((plane1[x >> 6] >> shift) & 0xF);
+
+		__m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(n0), bits), bits);
+		__m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(n1), bits), bits);
+		__m128i low = _mm_or_si128(_mm_and_si128(m0, c1), _mm_andnot_si128(m0, c0));
+		__m128i high = _mm_or_si128(_mm_and_si128(m0, c3), _mm_andnot_si128(m0, c2));
+		_mm_storeu_si128((__m128i*)&out[x], _mm_or_si128(_mm_and_si128(m1, high), _mm_andnot_si128(m1, low)));
+	}
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+// Same idea as the SSE2 kernel, a whole sprite byte (8 pixels) per step
+static void SDL_TARGETING("avx2") expand_row_avx2(const uint64_t* plane0, const uint64_t* plane1, int width, const Uint32 palette[4], Uint32* out)
+{
+	const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256i c0 = _mm256_set1_epi32((int)palette[0]);
+	const __m256i c1 = _mm256_set1_epi32((int)palette[1]);
+	const __m256i c2 = _mm256_set1_epi32((int)palette[2]);
+	const __m256i c3 = _mm256_set1_epi32((int)palette[3]);
+
+	for (int x = 0; x < width; x += 8)
+	{
+		int shift = 56 - (x & 63);
+		int b0 = (int)((plane0[x >> 6] >> shift) & 0xFF);
+		int b1 = (int)((plane1[x >> 6] >> shift) & 0xFF);
+
+		__m256i m0 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b0), bits), bits);
+		__m256i m1 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b1), bits), bits);
+		__m256i low = _mm256_blendv_epi8(c0, c1, m0);
+		__m256i high = _mm256_blendv_epi8(c2, c3, m0);
+		_mm256_storeu_si256((__m256i*)&out[x], _mm256_blendv_epi8(low, high, m1));
+	}
+}
+#endif
+
+static expand_row_fn expand_row = expand_row_scalar;
+
+// Picks the widest kernel the CPU supports. Call once before any other
+// thread uses video_expand().
+void video_init(void)
+{
+	expand_row = expand_row_scalar;
+#ifdef SDL_SSE2_INTRINSICS
+	if (SDL_HasSSE2())
+		expand_row = expand_row_sse2;
+#endif
+#ifdef SDL_AVX2_INTRINSICS
+	if (SDL_HasAVX2())
+		expand_row = expand_row_avx2;
+#endif
+}
+
+void video_expand(const uint64_t (*display)[CHIP8_HIRES_HEIGHT][2], int width, int first_row, int rows,
+	const Uint32 palette[4], int scale, Uint32* out, int pitch)
+{
+	Uint32 native[CHIP8_HIRES_WIDTH];
+	int stride = pitch / (int)sizeof(Uint32);
+
+	for (int y = first_row; y < first_row + rows; y++)
+	{
+		Uint32* dst = out + (y - first_row) * scale * stride;
+
+		if (scale == 1)
+		{
+			expand_row(display[0][y], display[1][y], width, palette, dst);
+			continue;
+		}
+
+		// Pre-scaled output: widen each pixel, then repeat the finished line
+		expand_row(display[0][y], display[1][y], width, palette, native);
+		for (int x = 0; x < width; x++)
+		{
+			for (int i = 0; i < scale; i++)
+				dst[x * scale + i] = native[x];
+		}
+		for (int i = 1; i < scale; i++)
+			memcpy(dst + i * stride, dst, width * scale * sizeof(Uint32));
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef _VIDEO_H
+#define _VIDEO_H
+#include "../include/SDL3/SDL.h"
+#include "cpu.h"
+
+// Expands rows of the bit-packed display into 32-bit pixels. palette is
+// indexed by (plane 1 bit << 1) | plane 0 bit. Each source pixel becomes a
+// scale x scale block; out points at the first output pixel of first_row and
+// pitch is the output row stride in bytes.
+void video_init(void);
+void video_expand(const uint64_t (*display)[CHIP8_HIRES_HEIGHT][2], int width, int first_row, int rows,
+	const Uint32 palette[4], int scale, Uint32* out, int pitch);
+#endif
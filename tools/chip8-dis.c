@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/disasm.h"
+#include "../src/rom.h"
+
+// Disassembles a ROM, separating reachable code from data, and optionally
+// prints its control-flow graph as a block list or in Graphviz format.
+
+static const char* const end_names[] = { "fall", "jump", "call", "skip", "ret", "exit", "indirect", "halt" };
+
+static void print_listing(const chip8_cfg_t* cfg, const uint8_t* image, size_t start, size_t end)
+{
+	char text[CHIP8_DISASM_MAX];
+
+	for (size_t addr = start; addr < end; )
+	{
+		uint8_t flags = cfg->flags[addr];
+
+		if (flags & CHIP8_ADDR_CODE)
+		{
+			if (flags & CHIP8_ADDR_CALL)
+				printf("\nsub_%03X:\n", (unsigned int)addr);
+			else if (flags & CHIP8_ADDR_LEADER)
+				printf("L%03X:\n", (unsigned int)addr);
+
+			int len = chip8_disassemble(&image[addr], cfg->size - addr, cfg->platform, text, sizeof(text));
+			printf("  %04X  %02X%02X%s  %s\n", (unsigned int)addr, image[addr], image[addr + 1], len == 4 ? "+" : " ", text);
+			addr += len;
+		}
+		else if (flags & CHIP8_ADDR_DATA)
+		{
+			// Data the code reads from: one byte per line, drawn as a sprite row
+			if (flags & CHIP8_ADDR_REF)
+				printf("data_%03X:\n", (unsigned int)addr);
+			printf("  %04X  %02X     DB %02X  ; ", (unsigned int)addr, image[addr], image[addr]);
+			for (int bit = 7; bit >= 0; bit--)
+				putchar((image[addr] >> bit) & 1 ? '#' : '.');
+			putchar('\n');
+			addr++;
+		}
+		else
+		{
+			// Unreached bytes, 8 per line until something else starts
+			if (flags & CHIP8_ADDR_REF)
+				printf("data_%03X:\n", (unsigned int)addr);
+			printf("  %04X         DB", (unsigned int)addr);
+			size_t i = 0;
+			do
+			{
+				printf(" %02X", image[addr + i]);
+				i++;
+			} while (i < 8 && addr + i < end && !(cfg->flags[addr + i] & (CHIP8_ADDR_CODE | CHIP8_ADDR_DATA | CHIP8_ADDR_REF)));
+			putchar('\n');
+			addr += i;
+		}
+	}
+}
+
+static void print_blocks(const chip8_cfg_t* cfg)
+{
+	for (int i = 0; i < cfg->block_count; i++)
+	{
+		const chip8_block_t* b = &cfg->blocks[i];
+		printf("%04X-%04X %-8s", b->start, (unsigned int)b->end - 1, end_names[b->kind]);
+		for (int s = 0; s < b->succ_count; s++)
+			printf(" %04X", b->succ[s]);
+		putchar('\n');
+	}
+}
+
+static void print_dot(const chip8_cfg_t* cfg, const uint8_t* image)
+{
+	char text[CHIP8_DISASM_MAX];
+
+	printf("digraph cfg {\n\tnode [shape=box fontname=monospace];\n");
+	for (int i = 0; i < cfg->block_count; i++)
+	{
+		const chip8_block_t* b = &cfg->blocks[i];
+		printf("\tb%04X [label=\"", b->start);
+		for (uint32_t addr = b->start; addr < b->end; )
+		{
+			int len = chip8_disassemble(&image[addr], cfg->size - addr, cfg->platform, text, sizeof(text));
+			printf("%04X  %s\\l", (unsigned int)addr, text);
+			addr += len;
+		}
+		printf("\"];\n");
+		for (int s = 0; s < b->succ_count; s++)
+		{
+			// A call's last successor is the callee; draw it apart from the return path
+			const char* style = b->kind == CHIP8_END_CALL && s == b->succ_count - 1 ? " [style=dashed]" : "";
+			if (chip8_cfg_find(cfg, b->succ[s]))
+				printf("\tb%04X -> b%04X%s;\n", b->start, b->succ[s], style);
+		}
+	}
+	printf("}\n");
+}
+
+int main(int argc, char const* argv[])
+{
+	const char* filename = NULL;
+	int platform = -1;
+	int blocks = 0;
+	int dot = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--schip") == 0)
+			platform = CHIP8_PLATFORM_SCHIP;
+		else if (strcmp(argv[i], "--xochip") == 0)
+			platform = CHIP8_PLATFORM_XOCHIP;
+		else if (strcmp(argv[i], "--chip8") == 0)
+			platform = CHIP8_PLATFORM_CHIP8;
+		else if (strcmp(argv[i], "--blocks") == 0)
+			blocks = 1;
+		else if (strcmp(argv[i], "--dot") == 0)
+			dot = 1;
+		else
+			filename = argv[i];
+	}
+
+	if (!filename)
+	{
+		printf("Usage: chip8-dis [--chip8 | --schip | --xochip] [--blocks | --dot] <rom>\n");
+		return -1;
+	}
+
+	chip8_rom_t rom;
+	if (chip8_rom_map(&rom, filename) < 0)
+		return -1;
+
+	// Known ROMs bring their platform; otherwise guess from the size
+	if (platform < 0)
+	{
+		const chip8_rom_info_t* info = chip8_rom_lookup(rom.data, rom.size);
+		if (info)
+			platform = info->platform;
+		else
+			platform = rom.size > CHIP8_MAX_ROM_SIZE ? CHIP8_PLATFORM_XOCHIP : CHIP8_PLATFORM_CHIP8;
+	}
+
+	size_t size = platform == CHIP8_PLATFORM_XOCHIP ? CHIP8_XO_MEM_SIZE : CHIP8_MEM_SIZE;
+	if (rom.size > size - CHIP8_PROG_START)
+	{
+		printf("ROM too large: %lu bytes\n", (unsigned long)rom.size);
+		chip8_rom_unmap(&rom);
+		return -1;
+	}
+
+	uint8_t* image = calloc(size, 1);
+	if (!image)
+	{
+		chip8_rom_unmap(&rom);
+		return -1;
+	}
+	if (rom.size)
+		memcpy(image + CHIP8_PROG_START, rom.data, rom.size);
+	size_t end = CHIP8_PROG_START + rom.size;
+	chip8_rom_unmap(&rom);
+
+	chip8_cfg_t cfg;
+	if (chip8_cfg_build(&cfg, image, size, CHIP8_PROG_START, platform) < 0)
+	{
+		free(image);
+		return -1;
+	}
+
+	if (dot)
+		print_dot(&cfg, image);
+	else if (blocks)
+		print_blocks(&cfg);
+	else
+		print_listing(&cfg, image, CHIP8_PROG_START, end);
+
+	chip8_cfg_free(&cfg);
+	free(image);
+	return 1;
+}
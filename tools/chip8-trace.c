@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/trace.h"
+
+// Decodes a binary execution trace written with --trace and prints the
+// instructions that pass every filter, one per line.
+
+typedef struct {
+	long pc_lo, pc_hi;
+	uint16_t op_mask, op_value;
+	int reg; // -1 for any
+	long mem; // -1 for any
+	Uint64 from, count;
+} filter_t;
+
+// Opcode patterns are four hex digits where any other character matches
+// anything, e.g. "DXYN" or "F_55"
+static int parse_pattern(const char* s, uint16_t* mask, uint16_t* value)
+{
+	if (strlen(s) != 4)
+		return -1;
+
+	*mask = 0;
+	*value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		int shift = 12 - i * 4;
+		char c = s[i];
+		int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+		if (digit >= 0)
+		{
+			*mask |= 0xF << shift;
+			*value |= digit << shift;
+		}
+	}
+	return 0;
+}
+
+static int matches(const filter_t* filter, const trace_record_t* record)
+{
+	if (record->pc < filter->pc_lo || record->pc > filter->pc_hi)
+		return 0;
+	if ((record->opcode & filter->op_mask) != filter->op_value)
+		return 0;
+	if (filter->reg >= 0 && !((record->regs >> filter->reg) & 1))
+		return 0;
+	if (filter->mem >= 0 && (filter->mem < record->mem_addr || filter->mem >= record->mem_addr + record->mem_count))
+		return 0;
+	return 1;
+}
+
+static void print_record(const trace_record_t* record)
+{
+	printf("%12llu  %04X  %04X  I=%04X", (unsigned long long)record->index, record->pc, record->opcode, record->ir);
+	for (int i = 0; i < 16; i++)
+	{
+		if ((record->regs >> i) & 1)
+			printf("  V%X=%02X", i, record->V[i]);
+	}
+	if (record->mem_count)
+	{
+		printf("  [%04X]=", record->mem_addr);
+		for (int i = 0; i < record->mem_count; i++)
+			printf("%02X", record->mem[i]);
+	}
+	putchar('\n');
+}
+
+int main(int argc, char const* argv[])
+{
+	filter_t filter = { 0, 0xFFFF, 0, 0, -1, -1, 0, (Uint64)-1 };
+	const char* filename = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc)
+		{
+			char* end;
+			filter.pc_lo = filter.pc_hi = strtol(argv[++i], &end, 16);
+			if (*end == '-')
+				filter.pc_hi = strtol(end + 1, NULL, 16);
+		}
+		else if (strcmp(argv[i], "--op") == 0 && i + 1 < argc)
+		{
+			if (parse_pattern(argv[++i], &filter.op_mask, &filter.op_value) < 0)
+			{
+				printf("Opcode patterns are four characters, like DXYN\n");
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--reg") == 0 && i + 1 < argc)
+			filter.reg = (int)strtol(argv[++i], NULL, 16) & 0xF;
+		else if (strcmp(argv[i], "--mem") == 0 && i + 1 < argc)
+			filter.mem = strtol(argv[++i], NULL, 16);
+		else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+			filter.from = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+			filter.count = strtoull(argv[++i], NULL, 10);
+		else
+			filename = argv[i];
+	}
+
+	if (!filename)
+	{
+		printf("Usage: chip8-trace [--pc <addr>[-<addr>]] [--op <pattern>] [--reg <x>] [--mem <addr>] [--from <n>] [--count <n>] <trace>\n");
+		return -1;
+	}
+
+	trace_reader_t reader;
+	if (trace_reader_open(&reader, filename) < 0)
+		return -1;
+
+	trace_record_t record;
+	Uint64 printed = 0;
+	int result = 0;
+	while (printed < filter.count && (result = trace_reader_next(&reader, &record)) > 0)
+	{
+		if (record.index >= filter.from && matches(&filter, &record))
+		{
+			print_record(&record);
+			printed++;
+		}
+	}
+
+	if (result < 0)
+		fprintf(stderr, "Trace is truncated or corrupt after instruction %llu\n", (unsigned long long)reader.index);
+	trace_reader_close(&reader);
+	return result < 0 ? -1 : 1;
+}